@@ -0,0 +1,298 @@
+/**
+   \file rasterizer_benchmark.cpp measures the rendering of the example scenes
+   and the parts of the rendering pipeline in isolation.
+*/
+
+#include "scene.h"
+#include "benchmark/benchmark.h"
+#include <dirent.h>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// the canvas size the example scenes are drawn for.
+static const int SCENE_SIZE = 500;
+
+// the names of the example scenes without the .obs suffix.
+static std::vector<std::string> list_examples()
+{
+  std::vector<std::string> names;
+  auto* dir = opendir(EXAMPLES_DIR);
+  if (!dir) {
+    return names;
+  }
+  while (auto* entry = readdir(dir)) {
+    std::string name(entry->d_name);
+    if (name.size() > 4 && name.substr(name.size() - 4) == ".obs") {
+      names.push_back(name.substr(0, name.size() - 4));
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// load the scene <name> scaled from SCENE_SIZE to a canvas of <size> pixels.
+static bool load_example(Scene& scene, const std::string& name, int size)
+{
+  if (!scene.load(std::string(EXAMPLES_DIR "/") + name + ".obs")) {
+    return false;
+  }
+  scene.resize(size, size);
+  auto scale = static_cast<float>(size) / SCENE_SIZE;
+  for (auto& p : scene.getPolygons()) {
+    for (auto& k : p->keyframes) {
+      for (auto& v : k.vertices) {
+        v.x *= scale;
+        v.y *= scale;
+      }
+    }
+  }
+  return true;
+}
+
+// the frame in the middle of the animation, where the polygons move.
+static int middle_frame(const Scene& scene)
+{
+  auto last = 1;
+  for (auto& p : scene.getPolygons()) {
+    last = std::max(last, p->keyframes.back().number);
+  }
+  return (last + 1) / 2;
+}
+
+// render the <frame> in every iteration, fail if a render allocates more or
+// less than the first one, and report the allocations of a render.
+static void render(benchmark::State& state, Scene& scene, int frame,
+                   const RenderSettings& settings)
+{
+  RenderStats first;
+  auto started = false;
+  for (auto _ : state) {
+    auto stats = scene.getRasterizer().run(scene.getPolygons(), frame,
+                                           settings);
+    if (!started) {
+      first = stats;
+      started = true;
+    } else if (stats.allocations != first.allocations) {
+      state.SkipWithError("the allocations per render are not steady");
+      break;
+    }
+  }
+  state.counters["allocations"] = first.allocations;
+  state.counters["allocated"] = first.allocated;
+  state.counters["peak"] = first.peak;
+}
+
+static void BM_Render(benchmark::State& state, const std::string& name)
+{
+  auto aa = static_cast<int>(state.range(0));
+  auto mb = static_cast<int>(state.range(1));
+  Scene scene;
+  if (!load_example(scene, name, state.range(2))) {
+    state.SkipWithError("can't load the scene");
+    return;
+  }
+  RenderSettings settings(aa > 1, aa, mb > 1, mb);
+  render(state, scene, middle_frame(scene), settings);
+  state.SetItemsProcessed(state.iterations() * scene.getWidth() *
+                          scene.getHeight());
+}
+
+// render the middle frame of a generated scene with 4 AA and 4 MB samples.
+static void BM_Stress(benchmark::State& state, StressSpec spec)
+{
+  spec.polygons = state.range(0);
+  spec.vertices = state.range(1);
+  spec.depth = state.range(2);
+  spec.motion = state.range(3);
+  Scene scene;
+  scene.generate(spec);
+  RenderSettings settings(true, 4, true, 4);
+  render(state, scene, middle_frame(scene), settings);
+  state.SetItemsProcessed(state.iterations() * spec.polygons);
+}
+
+// every dimension is scaled alone from 64 polygons of 8 vertices covering
+// every pixel 2 times, moving 8 pixels between the keyframes.
+static void stress_args(benchmark::internal::Benchmark* b)
+{
+  b->ArgNames({"polygons", "vertices", "depth", "motion"});
+  for (int polygons = 16; polygons <= 4096; polygons *= 4) {
+    b->Args({polygons, 8, 2, 8});
+  }
+  for (int vertices = 4; vertices <= 1024; vertices *= 4) {
+    b->Args({64, vertices, 2, 8});
+  }
+  for (int depth = 1; depth <= 16; depth *= 4) {
+    b->Args({64, 8, depth, 8});
+  }
+  for (int motion = 0; motion <= 64; motion = motion ? motion * 4 : 1) {
+    b->Args({64, 8, 2, motion});
+  }
+  b->Unit(benchmark::kMillisecond);
+}
+
+static StressSpec mix(float convex, float concave, float crossing)
+{
+  StressSpec spec;
+  spec.keyframes = 3;
+  spec.convex = convex;
+  spec.concave = concave;
+  spec.crossing = crossing;
+  return spec;
+}
+BENCHMARK_CAPTURE(BM_Stress, convex, mix(1, 0, 0))->Apply(stress_args);
+BENCHMARK_CAPTURE(BM_Stress, concave, mix(0, 1, 0))->Apply(stress_args);
+BENCHMARK_CAPTURE(BM_Stress, crossing, mix(0, 0, 1))->Apply(stress_args);
+
+// random polygons with 3 to 8 vertices, some of them concave.
+static std::vector<std::vector<Point>> random_polygons(int count, int size)
+{
+  std::mt19937 engine(count);
+  std::uniform_real_distribution<float> coordinate(-0.1f * size, 1.1f * size);
+  std::vector<std::vector<Point>> polygons(count);
+  for (int i = 0; i < count; ++i) {
+    for (int j = 0; j < 3 + i % 6; ++j) {
+      polygons[i].emplace_back(Point{coordinate(engine), coordinate(engine)});
+    }
+  }
+  return polygons;
+}
+
+static void BM_ScanConvert(benchmark::State& state)
+{
+  auto size = static_cast<int>(state.range(0));
+  auto polygons = random_polygons(64, size);
+  Rasterizer rasterizer(size, size);
+  for (auto _ : state) {
+    for (auto& p : polygons) {
+      rasterizer.scanConvert(p, RGB8{0x808080});
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * polygons.size());
+}
+BENCHMARK(BM_ScanConvert)->Arg(250)->Arg(500)->Arg(1000);
+
+static void BM_GetVertices(benchmark::State& state)
+{
+  Polygon polygon;
+  polygon.setColor(10, 20, 30);
+  for (int k = 0; k < 4; ++k) {
+    Frame f;
+    f.number = 1 + 10 * k;
+    for (int i = 0; i < state.range(0); ++i) {
+      f.vertices.emplace_back(Point{static_cast<float>(i + k),
+                                    static_cast<float>(i * k)});
+    }
+    polygon.keyframes.push_back(f);
+  }
+  std::vector<Point> vertices;
+  float frame = 1.0f;
+  for (auto _ : state) {
+    vertices.clear();
+    benchmark::DoNotOptimize(polygon.getVertices(frame, vertices));
+    frame = (frame < 30.0f) ? frame + 0.25f : 1.0f;
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GetVertices)->Arg(4)->Arg(64)->Arg(1024);
+
+// accumulate a canvas of <size> pixels with tiles of the colors <tag>, and
+// resolve it.
+static void BM_Abuffer(benchmark::State& state, unsigned int tag)
+{
+  auto size = static_cast<int>(state.range(0));
+  Abuffer abuf(size, size);
+  std::vector<RGB8> colors(abuf.size, RGB8{0x203040});
+  std::vector<RGB8> tags(abuf.columns * abuf.rows, RGB8{tag});
+  std::vector<RGB8> resolved(abuf.size);
+  for (auto _ : state) {
+    for (unsigned int weight = 1; weight <= 4; ++weight) {
+      abuf.add(colors.data(), tags.data(), weight);
+    }
+    abuf.get(resolved.data(), resolved.size(), 10);
+  }
+  state.SetItemsProcessed(state.iterations() * size * size);
+}
+BENCHMARK_CAPTURE(BM_Abuffer, mixed, MIXED_TILE)->Arg(500)->Arg(1000);
+BENCHMARK_CAPTURE(BM_Abuffer, uniform, 0x203040)->Arg(500)->Arg(1000);
+
+// pack a canvas of <size> pixels into 3 bytes each, as for every output.
+static void BM_Pack(benchmark::State& state)
+{
+  auto size = static_cast<int>(state.range(0));
+  Rasterizer rasterizer(size, size);
+  auto polygons = random_polygons(16, size);
+  for (auto _ : state) {
+    // filling a polygon marks the canvas as changed.
+    rasterizer.scanConvert(polygons[0], RGB8{0x102030});
+    benchmark::DoNotOptimize(rasterizer.getRGB());
+  }
+  state.SetBytesProcessed(state.iterations() * size * size * 3);
+}
+BENCHMARK(BM_Pack)->Arg(500)->Arg(1000);
+
+static void BM_SceneLoad(benchmark::State& state)
+{
+  Scene scene;
+  auto filename = std::string(EXAMPLES_DIR "/") + "sampleM.obs";
+  for (auto _ : state) {
+    if (!scene.load(filename)) {
+      state.SkipWithError("can't load the scene");
+      return;
+    }
+  }
+}
+BENCHMARK(BM_SceneLoad);
+
+static void BM_Save(benchmark::State& state)
+{
+  auto size = static_cast<int>(state.range(0));
+  Rasterizer rasterizer(size, size);
+  auto polygons = random_polygons(16, size);
+  for (auto& p : polygons) {
+    rasterizer.scanConvert(p, RGB8{0x102030});
+  }
+  std::string filename{"rasterizer_benchmark.ppm"};
+  for (auto _ : state) {
+    rasterizer.save(filename);
+  }
+  std::remove(filename.c_str());
+  state.SetBytesProcessed(state.iterations() * size * size * 3);
+}
+BENCHMARK(BM_Save)->Arg(500)->Arg(1000);
+
+int main(int argc, char** argv)
+{
+  // --isa=<level> forces the kernels of an instruction set level.
+  auto kept = 1;
+  for (int i = 1; i < argc; ++i) {
+    std::string s(argv[i]);
+    if (s.substr(0, 6) != "--isa=") {
+      argv[kept++] = argv[i];
+    } else if (!Kernels::select(Kernels::parse(s.substr(6)))) {
+      std::fprintf(stderr, "Can't use the kernels %s\n", s.c_str() + 6);
+      return 1;
+    }
+  }
+  argc = kept;
+  benchmark::AddCustomContext("isa", Kernels::name(Kernels::get().isa));
+  // every example scene at AA 1/4/16/64, MB 1/4/16 and 3 canvas sizes.
+  for (auto& name : list_examples()) {
+    auto* b = benchmark::RegisterBenchmark(("BM_Render/" + name).c_str(),
+                                           BM_Render, name);
+    b->ArgNames({"aa", "mb", "size"});
+    b->ArgsProduct({{1, 4, 16, 64}, {1, 4, 16}, {250, 500, 1000}});
+    b->Unit(benchmark::kMillisecond);
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
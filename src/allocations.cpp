@@ -0,0 +1,8 @@
+/**
+   \file allocations.cpp
+ */
+
+#include "allocations.h"
+
+thread_local Allocations Allocations::current = {0, 0, 0, 0};
+bool Allocations::counted = false;
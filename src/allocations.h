@@ -0,0 +1,42 @@
+/**
+   \file allocations.h
+
+   Counts of the heap allocations, kept by the global operator new and
+   delete of counting_new.cpp in the programs linked with it.
+*/
+
+#ifndef allocations_h
+#define allocations_h
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+   \brief Allocations count the heap allocations of a thread: how many there
+          were, their bytes, the bytes live now and the most bytes live since
+          the last mark.  Nothing is counted unless the program is linked with
+          counting_new.cpp, as the tests and the benchmarks are.
+*/
+struct Allocations {
+  size_t count;
+  size_t bytes;
+  int64_t live;
+  int64_t peak;
+
+  // the counts of the calling thread.
+  static thread_local Allocations current;
+  // set by counting_new.cpp when it's linked in.
+  static bool counted;
+
+  // start the peak over from the bytes live now and return the counts.
+  static Allocations mark() {
+    current.peak = current.live;
+    return current;
+  }
+};
+
+#endif /* allocations_h */
+
+// Local Variables:
+// mode: c++
+// End:
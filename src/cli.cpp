@@ -0,0 +1,15 @@
+/**
+   \file cli.cpp defines the rasterizer batch mode application, that renders
+   frames to files without the GUI.
+ */
+
+#include "scene.h"
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+  Scene s;
+  auto ok = s.renderToFile(std::vector<std::string>(argv + 1, argv + argc));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+/**
+   \file counting_new.cpp replaces the global operator new and delete with
+   ones that count the allocations of every thread in Allocations::current.
+   Only the programs that measure the allocations are linked with it.
+ */
+
+#include "allocations.h"
+#include <cstdlib>
+#include <new>
+
+// the size of every block is kept in front of it, in a header that keeps
+// the block aligned as malloc does.
+static const size_t HEADER = alignof(std::max_align_t);
+
+static struct Counted {
+  Counted() {
+    Allocations::counted = true;
+  }
+} counted;
+
+static void* allocate(size_t size)
+{
+  auto* block = static_cast<char*>(std::malloc(size + HEADER));
+  if (!block) {
+    return nullptr;
+  }
+  *reinterpret_cast<size_t*>(block) = size;
+  auto& counts = Allocations::current;
+  ++counts.count;
+  counts.bytes += size;
+  counts.live += size;
+  if (counts.live > counts.peak) {
+    counts.peak = counts.live;
+  }
+  return block + HEADER;
+} // allocate
+
+static void release(void* p)
+{
+  if (!p) {
+    return;
+  }
+  auto* block = static_cast<char*>(p) - HEADER;
+  Allocations::current.live -= *reinterpret_cast<size_t*>(block);
+  std::free(block);
+} // release
+
+void* operator new(size_t size)
+{
+  auto* p = allocate(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  release(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+  release(p);
+}
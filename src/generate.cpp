@@ -0,0 +1,61 @@
+/**
+   \file generate.cpp defines the program that writes synthetic scenes for
+   stress tests and benchmarks.
+ */
+
+#include "scene.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+
+static void usage()
+{
+  std::cout << "Usage: rasterizer-gen [-n<#polygons>] [-v<#vertices>]"
+            << " [-k<#keyframes>] [-t<convex>,<concave>,<crossing>]"
+            << " [-d<depth>] [-m<motion>] [-s<seed>] <outfile>\n";
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2 || std::string(argv[1]) == "-help") {
+    usage();
+    return argc < 2 ? 1 : 0;
+  }
+  StressSpec spec;
+  std::istringstream iss;
+  for (int i = 1; i < argc - 1; ++i) {
+    std::string s(argv[i]);
+    iss.clear();
+    iss.str(s.substr(2));
+    auto ok = true;
+    if (s.substr(0, 2) == "-n") {
+      ok = (iss >> spec.polygons) && spec.polygons >= 0;
+    } else if (s.substr(0, 2) == "-v") {
+      ok = (iss >> spec.vertices) && spec.vertices >= 3;
+    } else if (s.substr(0, 2) == "-k") {
+      ok = (iss >> spec.keyframes) && spec.keyframes >= 1;
+    } else if (s.substr(0, 2) == "-t") {
+      char comma;
+      ok = (iss >> spec.convex >> comma >> spec.concave >> comma
+                >> spec.crossing) && spec.convex >= 0 && spec.concave >= 0 &&
+           spec.crossing >= 0;
+    } else if (s.substr(0, 2) == "-d") {
+      ok = (iss >> spec.depth) && spec.depth > 0;
+    } else if (s.substr(0, 2) == "-m") {
+      ok = (iss >> spec.motion) && spec.motion >= 0;
+    } else if (s.substr(0, 2) == "-s") {
+      ok = bool(iss >> spec.seed);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::cerr << "Incorrect arguments: " << s << ".\n"
+                << "Type 'rasterizer-gen -help' for more info\n";
+      return 1;
+    }
+  }
+  Scene scene;
+  scene.generate(spec);
+  scene.save(argv[argc - 1]);
+  return 0;
+}
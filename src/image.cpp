@@ -0,0 +1,399 @@
+/**
+   \file image.cpp
+ */
+
+#include "image.h"
+#include "rasterizer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+
+Image::Image(const Rasterizer& rasterizer)
+  : width(rasterizer.getWidth()), height(rasterizer.getHeight())
+{
+  auto* data = rasterizer.getRGB();
+  rgb.assign(data, data + 3 * size_t(width) * height);
+}
+
+bool Image::load(const std::string& filename)
+{
+  std::ifstream input(filename, std::ios::binary);
+  std::string magic;
+  if (!(input >> magic) || magic != "P6") {
+    return false;
+  }
+  // the width, the height and the largest value, each may follow comments.
+  int header[3];
+  for (auto& h : header) {
+    while ((input >> std::ws).peek() == '#') {
+      input.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    if (!(input >> h) || h <= 0) {
+      return false;
+    }
+  }
+  if (header[2] != 255) {
+    return false;
+  }
+  input.get();
+  width = header[0];
+  height = header[1];
+  rgb.resize(3 * size_t(width) * height);
+  input.read(reinterpret_cast<char*>(rgb.data()), rgb.size());
+  return input.gcount() == static_cast<std::streamsize>(rgb.size());
+}
+
+bool Image::save(const std::string& filename) const
+{
+  std::ofstream output(filename, std::ios::binary);
+  output << "P6\n" << width << " " << height << "\n255\n";
+  output.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+  return bool(output);
+}
+
+Image Image::crop(int x, int y, int w, int h) const
+{
+  assert(x >= 0 && y >= 0 && x + w <= width && y + h <= height);
+  Image part(w, h);
+  for (int j = 0; j < h; ++j) {
+    auto* row = rgb.data() + 3 * (x + size_t(y + j) * width);
+    std::copy(row, row + 3 * w, part.rgb.begin() + 3 * size_t(j) * w);
+  }
+  return part;
+}
+
+void Image::paste(const Image& other, int x, int y)
+{
+  assert(x >= 0 && y >= 0 && x + other.width <= width &&
+         y + other.height <= height);
+  for (int j = 0; j < other.height; ++j) {
+    auto* row = other.rgb.data() + 3 * size_t(j) * other.width;
+    std::copy(row, row + 3 * other.width,
+              rgb.begin() + 3 * (x + size_t(y + j) * width));
+  }
+}
+
+double Image::psnr(const Image& other) const
+{
+  assert(width == other.width && height == other.height);
+  double se = 0;
+  for (size_t i = 0; i < rgb.size(); ++i) {
+    auto d = static_cast<int>(rgb[i]) - other.rgb[i];
+    se += d * d;
+  }
+  if (se == 0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 10 * std::log10(255.0 * 255.0 * rgb.size() / se);
+}
+
+int Image::maxError(const Image& other) const
+{
+  assert(width == other.width && height == other.height);
+  auto most = 0;
+  for (size_t i = 0; i < rgb.size(); ++i) {
+    most = std::max(most, std::abs(static_cast<int>(rgb[i]) - other.rgb[i]));
+  }
+  return most;
+}
+
+double Image::ssim(const Image& other) const
+{
+  assert(width == other.width && height == other.height);
+  static const int WINDOW = 8;
+  static const double C1 = (0.01 * 255) * (0.01 * 255);
+  static const double C2 = (0.03 * 255) * (0.03 * 255);
+  auto luma = [](const unsigned char* p) {
+    return 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+  };
+  auto sum = 0.0;
+  auto windows = 0;
+  for (int wy = 0; wy + WINDOW <= height; wy += WINDOW) {
+    for (int wx = 0; wx + WINDOW <= width; wx += WINDOW) {
+      double a = 0, b = 0, aa = 0, bb = 0, ab = 0;
+      for (int y = wy; y < wy + WINDOW; ++y) {
+        for (int x = wx; x < wx + WINDOW; ++x) {
+          auto i = 3 * (x + size_t(y) * width);
+          auto la = luma(&rgb[i]);
+          auto lb = luma(&other.rgb[i]);
+          a += la;
+          b += lb;
+          aa += la * la;
+          bb += lb * lb;
+          ab += la * lb;
+        }
+      }
+      auto n = WINDOW * WINDOW;
+      a /= n;
+      b /= n;
+      auto va = aa / n - a * a;
+      auto vb = bb / n - b * b;
+      auto cov = ab / n - a * b;
+      sum += (2 * a * b + C1) * (2 * cov + C2) /
+             ((a * a + b * b + C1) * (va + vb + C2));
+      ++windows;
+    }
+  }
+  return windows ? sum / windows : 1.0;
+}
+
+// the FLIC files are little endian.
+static unsigned int word(const unsigned char* p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static unsigned int dword(const unsigned char* p)
+{
+  return word(p) | word(p + 2) << 16;
+}
+
+/**
+   \brief decode the chunks of a frame into the <indices> of the palette
+          colors and the <palette>.  The <end> of the frame is checked before
+          every read.
+ */
+static bool decode_frame(const unsigned char* p, const unsigned char* end,
+                         int width, int height,
+                         std::vector<unsigned char>& indices,
+                         unsigned char palette[256][3])
+{
+  if (end - p < 16) {
+    return false;
+  }
+  auto chunks = word(p + 6);
+  p += 16;
+  for (unsigned int c = 0; c < chunks; ++c) {
+    if (end - p < 6) {
+      return false;
+    }
+    auto size = dword(p);
+    auto type = word(p + 4);
+    if (size < 6 || static_cast<size_t>(end - p) < size) {
+      return false;
+    }
+    auto* q = p + 6;
+    auto* e = p + size;
+    p = e;
+    switch (type) {
+    case 4:    // COLOR_256
+    case 11: { // COLOR_64
+      if (e - q < 2) {
+        return false;
+      }
+      auto packets = word(q);
+      q += 2;
+      auto shift = (type == 11) ? 2 : 0;
+      auto index = 0;
+      for (unsigned int k = 0; k < packets; ++k) {
+        if (e - q < 2) {
+          return false;
+        }
+        index += q[0];
+        auto count = q[1] ? q[1] : 256;
+        q += 2;
+        if (e - q < 3 * count || index + count > 256) {
+          return false;
+        }
+        for (auto n = 0; n < count; ++n, ++index, q += 3) {
+          for (int i = 0; i < 3; ++i) {
+            palette[index][i] = static_cast<unsigned char>(q[i] << shift);
+          }
+        }
+      }
+      break;
+    }
+    case 13: // BLACK
+      std::fill(indices.begin(), indices.end(), 0);
+      break;
+    case 15: { // BYTE_RUN
+      for (int y = 0; y < height; ++y) {
+        if (e - q < 1) {
+          return false;
+        }
+        ++q; // the obsolete packet count.
+        auto* line = indices.data() + y * width;
+        for (int x = 0; x < width;) {
+          if (e - q < 1) {
+            return false;
+          }
+          auto count = static_cast<signed char>(*q++);
+          if (count >= 0) {
+            if (e - q < 1 || x + count > width) {
+              return false;
+            }
+            std::fill(line + x, line + x + count, *q++);
+            x += count;
+          } else {
+            if (e - q < -count || x - count > width) {
+              return false;
+            }
+            std::copy(q, q - count, line + x);
+            q -= count;
+            x -= count;
+          }
+        }
+      }
+      break;
+    }
+    case 12: { // DELTA_FLI
+      if (e - q < 4) {
+        return false;
+      }
+      int y = word(q);
+      int lines = word(q + 2);
+      q += 4;
+      for (; lines > 0; --lines, ++y) {
+        if (e - q < 1 || y >= height) {
+          return false;
+        }
+        auto* line = indices.data() + y * width;
+        auto packets = *q++;
+        for (int x = 0; packets > 0; --packets) {
+          if (e - q < 2) {
+            return false;
+          }
+          x += *q++;
+          auto count = static_cast<signed char>(*q++);
+          if (count >= 0) {
+            if (e - q < count || x + count > width) {
+              return false;
+            }
+            std::copy(q, q + count, line + x);
+            q += count;
+            x += count;
+          } else {
+            if (e - q < 1 || x - count > width) {
+              return false;
+            }
+            std::fill(line + x, line + x - count, *q++);
+            x -= count;
+          }
+        }
+      }
+      break;
+    }
+    case 7: { // DELTA_FLC
+      if (e - q < 2) {
+        return false;
+      }
+      int lines = word(q);
+      q += 2;
+      for (int y = 0; lines > 0; ++y) {
+        if (e - q < 2) {
+          return false;
+        }
+        auto opcode = static_cast<int16_t>(word(q));
+        q += 2;
+        if ((opcode & 0xc000) == 0xc000) {
+          // skip the lines.
+          y -= opcode + 1;
+          continue;
+        }
+        if ((opcode & 0xc000) == 0x8000) {
+          // the last pixel of the line.
+          if (y < height) {
+            indices[y * width + width - 1] = opcode & 0xff;
+          }
+          --y;
+          continue;
+        }
+        --lines;
+        if (y >= height) {
+          return false;
+        }
+        auto* line = indices.data() + y * width;
+        for (int x = 0, packets = opcode; packets > 0; --packets) {
+          if (e - q < 2) {
+            return false;
+          }
+          x += *q++;
+          auto count = static_cast<signed char>(*q++);
+          if (count >= 0) {
+            if (e - q < 2 * count || x + 2 * count > width) {
+              return false;
+            }
+            std::copy(q, q + 2 * count, line + x);
+            q += 2 * count;
+            x += 2 * count;
+          } else {
+            if (e - q < 2 || x - 2 * count > width) {
+              return false;
+            }
+            for (int n = 0; n < -count; ++n, x += 2) {
+              line[x] = q[0];
+              line[x + 1] = q[1];
+            }
+            q += 2;
+          }
+        }
+      }
+      break;
+    }
+    case 16: // FLI_COPY
+      if (static_cast<size_t>(e - q) < indices.size()) {
+        return false;
+      }
+      std::copy(q, q + indices.size(), indices.begin());
+      break;
+    default: // PSTAMP and the others don't change the frame.
+      break;
+    }
+  }
+  return true;
+} // decode_frame
+
+bool loadFlic(const std::string& filename, std::vector<Image>& frames)
+{
+  std::ifstream input(filename, std::ios::binary);
+  std::vector<unsigned char> data((std::istreambuf_iterator<char>(input)),
+                                  std::istreambuf_iterator<char>());
+  if (data.size() < 128) {
+    return false;
+  }
+  auto magic = word(&data[4]);
+  auto count = word(&data[6]);
+  int width = word(&data[8]);
+  int height = word(&data[10]);
+  if ((magic != 0xaf11 && magic != 0xaf12) || word(&data[12]) != 8) {
+    return false;
+  }
+  // the frames of an FLC start where the header says, skipping the prefix.
+  size_t offset = (magic == 0xaf12 && dword(&data[80])) ? dword(&data[80])
+                                                        : 128;
+  std::vector<unsigned char> indices(width * height);
+  unsigned char palette[256][3] = {};
+  frames.clear();
+  auto* end = data.data() + data.size();
+  while (frames.size() < count) {
+    if (offset + 6 > data.size()) {
+      return false;
+    }
+    auto* p = data.data() + offset;
+    auto size = dword(p);
+    if (size < 6 || offset + size > data.size()) {
+      return false;
+    }
+    offset += size;
+    // skip the prefix chunks.
+    if (word(p + 4) != 0xf1fa) {
+      continue;
+    }
+    if (!decode_frame(p, std::min(p + size, end), width, height,
+                      indices, palette)) {
+      return false;
+    }
+    Image frame(width, height);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      std::copy(palette[indices[i]], palette[indices[i]] + 3,
+                frame.rgb.begin() + 3 * i);
+    }
+    frames.push_back(frame);
+  }
+  return true;
+}
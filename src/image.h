@@ -0,0 +1,66 @@
+/**
+   \file image.h
+
+   RGB images read from PPM files and FLI/FLC animations, to compare the
+   rendered frames with reference images.
+*/
+
+#ifndef image_h
+#define image_h
+
+#include <string>
+#include <vector>
+
+class Rasterizer;
+
+/**
+   \brief Image holds the pixels of an image, 3 bytes R, G, B per pixel, row
+          by row from the top.
+*/
+struct Image {
+  int width;
+  int height;
+  std::vector<unsigned char> rgb;
+
+  Image(int w = 0, int h = 0) : width(w), height(h), rgb(3 * size_t(w) * h)
+  {}
+
+  // the pixels of the canvas of the <rasterizer>.
+  explicit Image(const Rasterizer& rasterizer);
+
+  // read a binary PPM (P6) file of 8 bits per component.
+  bool load(const std::string& filename);
+  bool save(const std::string& filename) const;
+
+  // the <w> x <h> pixels of this image from the pixel (x, y).
+  Image crop(int x, int y, int w, int h) const;
+  // copy the <other> image into this one with its top left pixel at (x, y).
+  void paste(const Image& other, int x, int y);
+
+  /**
+     \brief the peak signal to noise ratio in dB of this image to the <other>
+            of the same size, infinite if they are the same.
+  */
+  double psnr(const Image& other) const;
+  // the largest difference of a color component.
+  int maxError(const Image& other) const;
+  /**
+     \brief the structural similarity of the luma of this image to the
+            <other>, averaged over windows of 8x8 pixels, 1 if they are the
+            same.
+  */
+  double ssim(const Image& other) const;
+};
+
+/**
+   \brief reads all frames of the FLI or FLC animation in the <filename>.
+   \return false if the file can't be read or is not an animation of 256
+           colors.
+*/
+bool loadFlic(const std::string& filename, std::vector<Image>& frames);
+
+#endif /* image_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -0,0 +1,252 @@
+/**
+   \file kernels.cpp
+
+   Every kernel is written once as an inline loop and compiled into a
+   function for every instruction set level, where the compiler vectorizes
+   it with the instructions of the level.  Only the packing of pixels into
+   3 bytes is written with byte shuffles, the compiler's vectors are slower.
+ */
+
+#include "kernels.h"
+#include <atomic>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KERNELS_X86
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_INLINE inline
+#define KERNEL_TARGET(isa)
+#endif
+
+static KERNEL_INLINE void accumulate_loop(RGB32* sums, const RGB8* colors,
+                                          size_t n, unsigned int weight)
+{
+  // the samples of weight 1, e.g. all of them with a box filter, are added
+  // without multiplying.
+  if (weight == 1) {
+    for (size_t i = 0; i < n; ++i) {
+      auto c = colors[i].pixel;
+      sums[i].r += c & 0xff;
+      sums[i].g += (c >> 8) & 0xff;
+      sums[i].b += (c >> 16) & 0xff;
+    }
+    return;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    auto c = colors[i].pixel;
+    sums[i].r += (c & 0xff) * weight;
+    sums[i].g += ((c >> 8) & 0xff) * weight;
+    sums[i].b += ((c >> 16) & 0xff) * weight;
+  }
+} // accumulate_loop
+
+// the quotients of integers below 2^32 are exact in double, and they are at
+// most 255.
+static KERNEL_INLINE void resolve_loop(RGB8* colors, const RGB32* sums,
+                                       size_t n, const RGB32& tile,
+                                       unsigned int k)
+{
+  auto divisor = static_cast<double>(k);
+  for (size_t i = 0; i < n; ++i) {
+    auto r = static_cast<int>((sums[i].r + tile.r) / divisor);
+    auto g = static_cast<int>((sums[i].g + tile.g) / divisor);
+    auto b = static_cast<int>((sums[i].b + tile.b) / divisor);
+    colors[i].pixel = r + (g << 8) + (b << 16);
+  }
+} // resolve_loop
+
+static KERNEL_INLINE void fill_loop(RGB8* pixels, size_t n, RGB8 color)
+{
+  auto c = color.pixel;
+  for (size_t i = 0; i < n; ++i) {
+    pixels[i].pixel = c;
+  }
+} // fill_loop
+
+static KERNEL_INLINE void pack_loop(const RGB8* pixels, size_t n,
+                                    unsigned char* rgb)
+{
+  for (size_t i = 0; i < n; ++i) {
+    auto c = pixels[i].pixel;
+    rgb[3 * i] = c & 0xff;
+    rgb[3 * i + 1] = (c >> 8) & 0xff;
+    rgb[3 * i + 2] = (c >> 16) & 0xff;
+  }
+} // pack_loop
+
+// the functions of the kernels compiled for the <target> level.
+#define DEFINE_KERNELS(level, target)                                       \
+  KERNEL_TARGET(target) static void accumulate_##level(                     \
+    RGB32* sums, const RGB8* colors, size_t n, unsigned int weight) {       \
+    accumulate_loop(sums, colors, n, weight);                               \
+  }                                                                         \
+  KERNEL_TARGET(target) static void resolve_##level(                        \
+    RGB8* colors, const RGB32* sums, size_t n, const RGB32& tile,           \
+    unsigned int k) {                                                       \
+    resolve_loop(colors, sums, n, tile, k);                                 \
+  }                                                                         \
+  KERNEL_TARGET(target) static void fill_##level(                           \
+    RGB8* pixels, size_t n, RGB8 color) {                                   \
+    fill_loop(pixels, n, color);                                            \
+  }
+
+#define KERNELS_OF(isa, level)                                          \
+  Kernels{Kernels::isa, accumulate_##level, resolve_##level, fill_##level, \
+          pack_##level}
+
+static void accumulate_generic(RGB32* sums, const RGB8* colors, size_t n,
+                               unsigned int weight)
+{
+  accumulate_loop(sums, colors, n, weight);
+}
+
+static void resolve_generic(RGB8* colors, const RGB32* sums, size_t n,
+                            const RGB32& tile, unsigned int k)
+{
+  resolve_loop(colors, sums, n, tile, k);
+}
+
+static void fill_generic(RGB8* pixels, size_t n, RGB8 color)
+{
+  fill_loop(pixels, n, color);
+}
+
+static void pack_generic(const RGB8* pixels, size_t n, unsigned char* rgb)
+{
+  pack_loop(pixels, n, rgb);
+}
+
+#ifdef KERNELS_X86
+DEFINE_KERNELS(sse42, "sse4.2")
+DEFINE_KERNELS(avx2, "avx2")
+DEFINE_KERNELS(avx512, "avx512f,avx512bw")
+
+// the bytes R, G, B of 4 pixels in the first 12 bytes.
+#define PACK_SHUFFLE 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+/**
+   \brief packs 4 pixels at a time with a byte shuffle.  Every store writes 16
+          bytes of which 12 are pixels, the next store overwrites the rest.
+ */
+KERNEL_TARGET("sse4.2")
+static void pack_sse42(const RGB8* pixels, size_t n, unsigned char* rgb)
+{
+  auto shuffle = _mm_setr_epi8(PACK_SHUFFLE);
+  size_t i = 0;
+  for (; i + 6 <= n; i += 4) {
+    auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + 3 * i),
+                     _mm_shuffle_epi8(p, shuffle));
+  }
+  pack_loop(pixels + i, n - i, rgb + 3 * i);
+}
+
+/**
+   \brief packs 8 pixels at a time, the shuffle packs each half of 4 pixels
+          and a permutation moves the 24 bytes together.
+ */
+KERNEL_TARGET("avx2")
+static void pack_avx2(const RGB8* pixels, size_t n, unsigned char* rgb)
+{
+  auto shuffle = _mm256_setr_epi8(PACK_SHUFFLE, PACK_SHUFFLE);
+  auto together = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+  size_t i = 0;
+  for (; i + 11 <= n; i += 8) {
+    auto p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+    p = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(p, shuffle),
+                                    together);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgb + 3 * i), p);
+  }
+  pack_loop(pixels + i, n - i, rgb + 3 * i);
+}
+
+// 16 pixels at a time would need a permutation of bytes across the lanes,
+// AVX-512 packs as AVX2.
+static void (* const pack_avx512)(const RGB8*, size_t, unsigned char*) =
+  pack_avx2;
+#endif
+
+static const Kernels* table()
+{
+#ifdef KERNELS_X86
+  static const Kernels kernels[] = {
+    KERNELS_OF(GENERIC, generic), KERNELS_OF(SSE42, sse42),
+    KERNELS_OF(AVX2, avx2), KERNELS_OF(AVX512, avx512)
+  };
+#else
+  // the other levels are never supported.
+  static const Kernels kernels[] = {KERNELS_OF(GENERIC, generic)};
+#endif
+  return kernels;
+}
+
+static std::atomic<int> selected(-1);
+
+const Kernels& Kernels::get()
+{
+  auto isa = selected.load(std::memory_order_relaxed);
+  if (isa < 0) {
+    isa = detect();
+    selected.store(isa, std::memory_order_relaxed);
+  }
+  return table()[isa];
+}
+
+Kernels::ISA Kernels::detect()
+{
+  for (auto isa = static_cast<int>(AVX512); isa > GENERIC; --isa) {
+    if (supported(static_cast<ISA>(isa))) {
+      return static_cast<ISA>(isa);
+    }
+  }
+  return GENERIC;
+}
+
+bool Kernels::supported(ISA isa)
+{
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  switch (isa) {
+  case GENERIC:
+    return true;
+  case SSE42:
+    return __builtin_cpu_supports("sse4.2");
+  case AVX2:
+    return __builtin_cpu_supports("avx2");
+  case AVX512:
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+  default:
+    return false;
+  }
+#else
+  return isa == GENERIC;
+#endif
+}
+
+bool Kernels::select(ISA isa)
+{
+  if (!supported(isa)) {
+    return false;
+  }
+  selected.store(isa, std::memory_order_relaxed);
+  return true;
+}
+
+static const char* const NAMES[] = {"generic", "sse4.2", "avx2", "avx512"};
+
+const char* Kernels::name(ISA isa)
+{
+  return isa < ISA_COUNT ? NAMES[isa] : "";
+}
+
+Kernels::ISA Kernels::parse(const std::string& s)
+{
+  auto isa = static_cast<int>(GENERIC);
+  while (isa < ISA_COUNT && s != NAMES[isa]) {
+    ++isa;
+  }
+  return static_cast<ISA>(isa);
+}
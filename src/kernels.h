@@ -0,0 +1,54 @@
+/**
+   \file kernels.h
+
+   The inner loops of the rendering over runs of pixels, compiled for several
+   instruction set levels.  The best level the CPU supports is selected at
+   startup, another one can be forced for testing and benchmarking.
+*/
+
+#ifndef kernels_h
+#define kernels_h
+
+#include "polygon.h"
+#include <cstddef>
+#include <string>
+
+/**
+   \brief Kernels is a table of the loops compiled for one instruction set
+          level.  All levels compute the same results.
+*/
+struct Kernels {
+  enum ISA { GENERIC, SSE42, AVX2, AVX512, ISA_COUNT };
+
+  ISA isa;
+  // add the <n> <colors> times the <weight> to the <sums>.
+  void (*accumulate)(RGB32* sums, const RGB8* colors, size_t n,
+                     unsigned int weight);
+  // the <n> <sums> plus the <tile> sum divided by <k> into the <colors>.
+  void (*resolve)(RGB8* colors, const RGB32* sums, size_t n,
+                  const RGB32& tile, unsigned int k);
+  void (*fill)(RGB8* pixels, size_t n, RGB8 color);
+  // the <n> <pixels> as 3 bytes R, G, B each into <rgb>.
+  void (*pack)(const RGB8* pixels, size_t n, unsigned char* rgb);
+
+  // the kernels in use.
+  static const Kernels& get();
+  // the best level this CPU supports.
+  static ISA detect();
+  static bool supported(ISA isa);
+  /**
+     \brief uses the kernels of the <isa> from now on, it must not be called
+            while frames are rendered.
+     \return false if the CPU doesn't support the <isa>.
+  */
+  static bool select(ISA isa);
+  static const char* name(ISA isa);
+  // the level named <s>, e.g. "avx2", or ISA_COUNT if there is none.
+  static ISA parse(const std::string& s);
+};
+
+#endif /* kernels_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -6,8 +6,10 @@
  */
 
 #include "polygon.h"
+#include "trace.h"
 
 #include <cassert>
+#include <limits>
 #include <ostream>
 
 std::ostream& operator<<(std::ostream& os, const RGB8& p)
@@ -36,11 +38,45 @@ std::ostream& operator<<(std::ostream& os, const Polygon& p)
   return os;
 }
 
+bool isConvex(const std::vector<Point>& vertices)
+{
+  auto size = vertices.size();
+  if (size < 3) {
+    return false;
+  }
+  auto turn = 0.0f;
+  auto direction = 0.0f;
+  auto flips = 0;
+  // go around twice to see the flips of direction along x over a whole round
+  for (decltype(size) i = 0; i < 2 * size; ++i) {
+    auto& a = vertices[i % size];
+    auto& b = vertices[(i + 1) % size];
+    auto& c = vertices[(i + 2) % size];
+    auto cross = (b.x - a.x) * (c.y - b.y) - (b.y - a.y) * (c.x - b.x);
+    if (cross * turn < 0.0f) {
+      return false;
+    }
+    if (cross != 0.0f) {
+      turn = cross;
+    }
+    auto dx = b.x - a.x;
+    if (i >= size && dx * direction < 0.0f) {
+      ++flips;
+    }
+    if (dx != 0.0f) {
+      direction = dx;
+    }
+  }
+  // a convex polygon changes the direction along x only twice
+  return turn != 0.0f && flips <= 2;
+}
+
 /**
    \returns the set of vertices in the frame, probably interpolated.
  */
 RGB8 Polygon::getVertices(const float frame, std::vector<Point>& vertices)
 {
+  TRACE_DETAIL("Polygon::getVertices");
   assert(frame >= 1.0f);
   auto kE = keyframes.cend();
   auto prevIt = kE, nextIt = kE;
@@ -76,6 +112,73 @@ RGB8 Polygon::getVertices(const float frame, std::vector<Point>& vertices)
   return getColor();
 }
 
+/**
+   \returns the maximum over vertices of the length of the piecewise linear path
+            the vertex follows between the frames <first> and <last>.
+ */
+float Polygon::getDisplacement(float first, float last)
+{
+  float end = (keyframes.end() - 1)->number;
+  first = std::max(1.0f, std::min(first, end));
+  last = std::max(1.0f, std::min(last, end));
+  if (first >= last) {
+    return 0.0f;
+  }
+  std::vector<Point> prev, next;
+  getVertices(first, prev);
+  std::vector<float> path(prev.size(), 0.0f);
+  auto step = [&prev, &path](std::vector<Point>& next) {
+    for (decltype(path.size()) i = 0; i < path.size(); ++i) {
+      path[i] += next[i] % prev[i];
+    }
+    prev = next;
+  };
+  // the vertices move linearly between keyframes
+  for (auto& k : keyframes) {
+    if (first < k.number && k.number < last) {
+      step(k.vertices);
+    }
+  }
+  getVertices(last, next);
+  step(next);
+  return path.empty() ? 0.0f : *std::max_element(path.begin(), path.end());
+}
+
+/**
+   \brief the vertices move linearly between keyframes, so the polygon stays
+          in the box of its vertices at <first>, at <last> and at the
+          keyframes between them.
+ */
+void Polygon::getBounds(float first, float last, Point& lo, Point& hi)
+{
+  float end = (keyframes.end() - 1)->number;
+  first = std::max(1.0f, std::min(first, end));
+  last = std::max(1.0f, std::min(last, end));
+  lo = Point{std::numeric_limits<float>::max(),
+             std::numeric_limits<float>::max()};
+  hi = Point{std::numeric_limits<float>::lowest(),
+             std::numeric_limits<float>::lowest()};
+  auto extend = [&lo, &hi](const std::vector<Point>& vertices) {
+    for (auto& v : vertices) {
+      lo.x = std::min(lo.x, v.x);
+      lo.y = std::min(lo.y, v.y);
+      hi.x = std::max(hi.x, v.x);
+      hi.y = std::max(hi.y, v.y);
+    }
+  };
+  std::vector<Point> vertices;
+  getVertices(first, vertices);
+  extend(vertices);
+  for (auto& k : keyframes) {
+    if (first < k.number && k.number < last) {
+      extend(k.vertices);
+    }
+  }
+  vertices.clear();
+  getVertices(last, vertices);
+  extend(vertices);
+}
+
 /**
    \brief Look for a keyframe at <frame>.  If we don't find it, then create a
           new one in the right place.
@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <ostream>
 #include <vector>
 
 struct RGB8 {
@@ -152,10 +153,27 @@ struct Polygon {
             linearly and give you the correct values.
    */
   RGB8 getVertices(const float frame, std::vector<Point>& vertices);
+  /**
+     \brief Find the longest distance any vertex of the polygon travels
+            between the frames <first> and <last>.  Zero means the polygon
+            doesn't move during this time.
+   */
+  float getDisplacement(float first, float last);
+  /**
+     \brief Find the box from <lo> to <hi> the polygon stays in between the
+            frames <first> and <last>.
+   */
+  void getBounds(float first, float last, Point& lo, Point& hi);
   std::vector<Frame>::iterator findOrCreateKeyframe(int frame);
 
 };
 
+/**
+   \brief Check if the polygon with the <vertices> is convex, i.e. it turns
+          the same way at every vertex and goes around only once.
+ */
+bool isConvex(const std::vector<Point>& vertices);
+
 std::ostream& operator<<(std::ostream& os, const Point& p);
 std::ostream& operator<<(std::ostream& os, const Polygon& obj);
 
@@ -6,22 +6,33 @@
  */
 
 #include "rasterizer.h"
+#include "allocations.h"
+#include "trace.h"
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <cmath>
 #include <fstream>
+#include <iomanip>
+#include <limits>
 #include <list>
+#include <numeric>
 #include <ostream>
-#include <random>
 #include <sstream>
 #include <string>
 
-static SHIFT_MODE shift_mode = SHIFT_MODE::RANDOM;
-static WEIGHT_FUN weight_fun = WEIGHT_FUN::BOX;
-static std::uniform_real_distribution<float> urf(-0.5f, 0.5f);
-static std::default_random_engine e;
+using Clock = std::chrono::steady_clock;
+
+// Add the time since <start> to the <phase> and start again.
+static void lap(double& phase, Clock::time_point& start)
+{
+  auto now = Clock::now();
+  phase += std::chrono::duration<double>(now - start).count();
+  start = now;
+}
 
 // Bartlett filter implementation:
-inline int filter(int sample, int total)
+inline int filter(WEIGHT_FUN weight_fun, int sample, int total)
 {
   if (WEIGHT_FUN::BOX == weight_fun ||
       (sample == total / 2 && 0 == total % 2)) {
@@ -30,14 +41,41 @@ inline int filter(int sample, int total)
   return (sample < total / 2 + total % 2) ? 1 : - 1;
 } // bartlett
 
-static float shift_function(SHIFT_MODE mode)
+// Philox-2x32 with 10 rounds, a counter based random number generator: the
+// result is a pure function of the <counter> and the <key>.
+static uint64_t philox(uint64_t counter, uint32_t key)
+{
+  auto lo = static_cast<uint32_t>(counter);
+  auto hi = static_cast<uint32_t>(counter >> 32);
+  for (int round = 0; round < 10; ++round) {
+    auto product = uint64_t(0xd256d193) * lo;
+    lo = static_cast<uint32_t>(product >> 32) ^ key ^ hi;
+    hi = static_cast<uint32_t>(product);
+    key += 0x9e3779b9;
+  }
+  return (uint64_t(lo) << 32) | hi;
+} // philox
+
+// The shift in [-0.5, 0.5) of the <axis> coordinate of the AA <sample>.
+// Samples are shifted in the same way no matter in which order they are
+// rendered.  The shifts are the same in every frame: the still polygons
+// cached in layers, and the frames reused for the ones after them, are
+// sampled exactly as when every frame is rendered on its own.
+static float shift_function(const RenderSettings& settings, int sample,
+                            int axis)
 {
-  return (SHIFT_MODE::RANDOM == mode) ? urf(e) : 0.0f;
+  if (SHIFT_MODE::RANDOM != settings.shift_mode) {
+    return 0.0f;
+  }
+  auto counter = uint64_t(sample << 1) | axis;
+  auto bits = philox(counter, settings.seed) >> 40;
+  return bits * (1.0f / (1 << 24)) - 0.5f;
 } // shift_function
 
 // Build a table of coordinate shifts within a pixel boundaries.
 // Every value in data array is in the range [-0.5, 0.5].
-static void precompute_shifts(Point data[8][8], int dim)
+static void precompute_shifts(Point data[8][8], int dim,
+                              const RenderSettings& settings)
 {
   if (1 == dim) {
     data[0][0].x = 0.0;
@@ -48,12 +86,14 @@ static void precompute_shifts(Point data[8][8], int dim)
   if (dim > 8) dim = 8;
   auto shift = 1.0 / static_cast<float>(dim);
   auto start = shift / 2.0 - 0.5;
-  auto incell = shift_function(shift_mode);
 
   for (int ii = 0; ii < dim; ++ii) {
     for (int jj = 0; jj < dim; ++jj) {
-      data[ii][jj].x = start + ii * shift + incell * shift;
-      data[ii][jj].y = start + jj * shift + incell * shift;
+      auto sample = ii * dim + jj;
+      data[ii][jj].x = start + ii * shift +
+        shift_function(settings, sample, 0) * shift;
+      data[ii][jj].y = start + jj * shift +
+        shift_function(settings, sample, 1) * shift;
     }
   }
   if (1 == dim % 2) {
@@ -62,19 +102,73 @@ static void precompute_shifts(Point data[8][8], int dim)
   }
 } // precompute_shifts
 
-static void parse_aafilter_func(const std::string& expr)
+RenderSettings::RenderSettings(bool aa_enabled, int num_aa_samples,
+                               bool mb_enabled, int num_mb_samples,
+                               const std::string& aa_filter)
+  : num_aa_samples(aa_enabled ? num_aa_samples : 1)
+  , num_mb_samples(mb_enabled ? num_mb_samples : 1)
+  , shift_mode(SHIFT_MODE::RANDOM)
+  , weight_fun(WEIGHT_FUN::BOX)
+  , seed(0)
+  , budget(0)
 {
-  if (std::string::npos != expr.find("rand")) {
+  auto has = [&aa_filter](const char* command) {
+    return std::string::npos != aa_filter.find(command);
+  };
+  adaptive = has("adapt");
+  halfspace = has("halfspace");
+  if (has("rand")) {
     shift_mode = SHIFT_MODE::RANDOM;
-  } else if (std::string::npos != expr.find("grid")) {
+  } else if (has("grid")) {
     shift_mode = SHIFT_MODE::GRID;
-  } else if (std::string::npos != expr.find("bart")) {
+  }
+  if (has("bart")) {
     weight_fun = WEIGHT_FUN::BARTLETT;
-  } else if (std::string::npos != expr.find("box")) {
+  } else if (has("box")) {
     weight_fun = WEIGHT_FUN::BOX;
   }
 }
 
+/**
+   \brief order the cells of a grid of <n> cells in <dims> dimensions so that
+          the cells of every prefix of the order are spread over the grid:
+          every cell is the farthest from the cells before it, the first one
+          is in the middle.
+ */
+static std::vector<int> spread(int n, int dims)
+{
+  auto size = (dims == 1) ? n : n * n;
+  auto coordinates = [n, dims](int c) {
+    return (dims == 1) ? Point{static_cast<float>(c), 0.0f}
+                       : Point{static_cast<float>(c % n),
+                               static_cast<float>(c / n)};
+  };
+  // the squared distance of every cell to the nearest one taken.
+  std::vector<float> distance(size, std::numeric_limits<float>::max());
+  std::vector<int> order;
+  auto next = (dims == 1) ? n / 2 : n / 2 + n / 2 * n;
+  while (true) {
+    order.push_back(next);
+    distance[next] = -1;
+    auto p = coordinates(next);
+    next = -1;
+    for (int c = 0; c < size; ++c) {
+      if (distance[c] < 0) {
+        continue;
+      }
+      auto q = coordinates(c);
+      auto d = (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y);
+      distance[c] = std::min(distance[c], d);
+      if (next < 0 || distance[c] > distance[next]) {
+        next = c;
+      }
+    }
+    if (next < 0) {
+      return order;
+    }
+  }
+} // spread
+
 static void add_edge(std::unique_ptr<std::list<Edge>[]>& et,
                      const Point& lo, const Point& hi, const int bias)
 {
@@ -88,94 +182,668 @@ static void add_edge(std::unique_ptr<std::list<Edge>[]>& et,
   et[bucket].emplace_back(Edge(hi.y, xmin, slope));
 } // add_edge
 
+// Mark the pixels whose color differs from any of their 8 neighbours.  These
+// are the pixels crossed by polygon edges, only they need all the AA samples.
+static void find_edges(const RGB8* p, const Layout& layout, Mask& mask)
+{
+  auto width = layout.width;
+  auto height = layout.height;
+  for (int y = 0; y < height; ++y) {
+    auto& runs = mask.lines[y];
+    runs.clear();
+    auto ymin = std::max(y - 1, 0);
+    auto ymax = std::min(y + 1, height - 1);
+    for (int x = 0; x < width; ++x) {
+      auto xmin = std::max(x - 1, 0);
+      auto xmax = std::min(x + 1, width - 1);
+      auto c = p[layout.index(x, y)].pixel;
+      auto edge = false;
+      for (int j = ymin; !edge && j <= ymax; ++j) {
+        for (int i = xmin; !edge && i <= xmax; ++i) {
+          edge = (p[layout.index(i, j)].pixel != c);
+        }
+      }
+      if (!edge) {
+        continue;
+      }
+      if (!runs.empty() && runs.back().second == x - 1) {
+        runs.back().second = x;
+      } else {
+        runs.emplace_back(x, x);
+      }
+      ++mask.count;
+    }
+  }
+} // find_edges
+
+// MB sample time and its filter weight.
+struct Shot {
+  float frame;
+  int weight;
+};
+
+// Compute the times of the MB samples of the frame <frame_num> that are not
+// before the first frame.
+static std::vector<Shot> make_shots(int frame_num, int num_mb_samples,
+                                    WEIGHT_FUN weight_fun)
+{
+  float frame_shift = 0.0;
+  float frame_offset = 0.0;
+  if (num_mb_samples > 1) {
+    frame_offset = 1.0 / (2.0 * (float)num_mb_samples) - 0.5;
+    frame_shift = 1.0 / (float)num_mb_samples;
+  }
+  std::vector<Shot> shots;
+  int mbfilt = 1;
+  for (int mov = 0; mov < num_mb_samples; ++mov) {
+    float frame = (float)frame_num + frame_offset + frame_shift * mov;
+    if (frame >= 1.0) {
+      shots.push_back(Shot{frame, mbfilt});
+    }
+    mbfilt += filter(weight_fun, mov + 1, num_mb_samples);
+  }
+  assert(!shots.empty());
+  return shots;
+} // make_shots
+
+// FNV-1a hash of <size> bytes at <data> continuing from the hash <h>.
+static uint64_t hash(uint64_t h, const void* data, size_t size)
+{
+  auto* p = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+} // hash
+
+// Merge the MB samples <shots> into as many groups as the fastest polygon
+// needs: one sample per MB_STEP pixels of motion during the shutter interval.
+// The polygons that need no more than a single sample are not <moving>.
+static std::vector<Shot>
+group_shots(const std::vector<std::shared_ptr<Polygon>>& polygons,
+            const std::vector<Shot>& shots, std::vector<bool>& moving)
+{
+  static const float MB_STEP = 1.0f;
+  size_t count = 1;
+  for (size_t i = 0; i < polygons.size(); ++i) {
+    auto d = polygons[i]->getDisplacement(shots.front().frame,
+                                          shots.back().frame);
+    auto n = std::min(shots.size(), static_cast<size_t>(ceilf(d / MB_STEP)));
+    moving[i] = (n > 1);
+    count = std::max(count, n);
+  }
+  if (count == shots.size()) {
+    return shots;
+  }
+  std::vector<Shot> groups;
+  for (size_t g = 0; g < count; ++g) {
+    Shot group{0.0f, 0};
+    auto E = (g + 1) * shots.size() / count;
+    for (auto k = g * shots.size() / count; k < E; ++k) {
+      group.frame += shots[k].frame * shots[k].weight;
+      group.weight += shots[k].weight;
+    }
+    group.frame /= group.weight;
+    groups.push_back(group);
+  }
+  return groups;
+} // group_shots
+
+// Vertex coordinates are converted to 24.8 fixed point.  They must be at most
+// LIMIT pixels away from the origin for the edge setup not to overflow 64
+// bits, the edges reaching further are clipped first.
+static const int64_t FIXED_ONE = 1 << 8;
+static const double LIMIT = 1 << 20;
+
+static int64_t to_fixed(double v)
+{
+  return llround(v * FIXED_ONE);
+}
+
+static bool in_limit(const Point& p)
+{
+  return std::abs(p.x) <= LIMIT && std::abs(p.y) <= LIMIT;
+}
+
+// Call f(x0, y0, x1, y1) with the edge from <p> to <q> in fixed point.  An
+// edge beyond the LIMIT is cut to the lines [-LIMIT, LIMIT], and its parts
+// left or right of the LIMIT are moved onto it as vertical edges: they cross
+// every line on the same side of the canvas as before, and the part between
+// them keeps the slope of the edge.
+template <typename F>
+static void clip_edge(const Point& p, const Point& q, F f)
+{
+  if (in_limit(p) && in_limit(q)) {
+    f(to_fixed(p.x), to_fixed(p.y), to_fixed(q.x), to_fixed(q.y));
+    return;
+  }
+  double x0 = p.x, y0 = p.y, x1 = q.x, y1 = q.y;
+  if (y0 > y1) {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+  if (y1 < -LIMIT || y0 > LIMIT || y0 == y1) {
+    return;
+  }
+  auto x_at = [=](double y) {
+    return x0 + (x1 - x0) * (y - y0) / (y1 - y0);
+  };
+  if (y0 < -LIMIT) {
+    x0 = x_at(-LIMIT);
+    y0 = -LIMIT;
+  }
+  if (y1 > LIMIT) {
+    x1 = x_at(LIMIT);
+    y1 = LIMIT;
+  }
+  // the lines where the edge crosses x = -LIMIT and x = LIMIT, top down.
+  auto y_at = [=](double x) {
+    return y0 + (y1 - y0) * (x - x0) / (x1 - x0);
+  };
+  double ys[4] = {y0, y0, y0, y1};
+  auto n = 1;
+  for (auto x : {-LIMIT, LIMIT}) {
+    if ((x0 < x && x < x1) || (x1 < x && x < x0)) {
+      ys[n++] = y_at(x);
+    }
+  }
+  if (n == 3 && ys[2] < ys[1]) {
+    std::swap(ys[1], ys[2]);
+  }
+  ys[n] = y1;
+  for (int i = 0; i < n; ++i) {
+    auto xa = (i == 0) ? x0 : x_at(ys[i]);
+    auto xb = (i == n - 1) ? x1 : x_at(ys[i + 1]);
+    auto side = std::max(-LIMIT, std::min(LIMIT, (xa + xb) / 2));
+    if (std::abs(side) == LIMIT) {
+      xa = xb = side;
+    }
+    f(to_fixed(xa), to_fixed(ys[i]), to_fixed(xb), to_fixed(ys[i + 1]));
+  }
+} // clip_edge
+
+// floor(a / b) for b > 0
+static int64_t floor_div(int64_t a, int64_t b)
+{
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+// Set up the <edge> from (x0, y0) to (x1, y1), y0 < y1, to walk the lines it
+// crosses on the canvas of the <height>.  The edge crosses the line y at
+//   x = x0 + (x1 - x0) * (y - y0) / (y1 - y0),
+// which is split into the integer pixel and the exact remainder.
+static bool add_fixed_edge(int64_t x0, int64_t y0, int64_t x1, int64_t y1,
+                           int height, FixedEdge& edge)
+{
+  auto ymin = std::max(-floor_div(-y0, FIXED_ONE), int64_t(0));
+  auto ymax = std::min(-floor_div(-y1, FIXED_ONE), int64_t(height));
+  if (ymin >= ymax) {
+    return false;
+  }
+  auto dx = x1 - x0;
+  auto dy = y1 - y0;
+  auto xi = floor_div(x0, FIXED_ONE);
+  auto n = (x0 - xi * FIXED_ONE) * dy + dx * (ymin * FIXED_ONE - y0);
+  edge.den = dy * FIXED_ONE;
+  edge.x = xi + floor_div(n, edge.den);
+  edge.f = n - (edge.x - xi) * edge.den;
+  edge.step = floor_div(dx * FIXED_ONE, edge.den);
+  edge.rem = dx * FIXED_ONE - edge.step * edge.den;
+  edge.ymin = static_cast<int>(ymin);
+  edge.ymax = static_cast<int>(ymax);
+  return true;
+} // add_fixed_edge
+
+// Edge function E(x, y) = a * x + b * y + c of the edge starting at the vertex
+// (x, y) for the pixel (x, y) inside a convex polygon is not negative.  Over a
+// block of pixels E is the smallest at the offset lo from the top left pixel
+// of the block and the largest at the offset hi, e is E at the block.
+struct HalfSpace {
+  int64_t x, y;
+  int64_t a, b, c;
+  int64_t lo, hi, e;
+};
+
 /**
    \brief drive the rasterization of a frame
+
+   In adaptive mode every MB sample is first rendered with a single AA sample
+   in the pixel center.  Then only the pixels near edges found in this image
+   are rendered again with the full set of AA samples.
+
+   The number of MB samples is reduced to what the fastest moving polygon
+   needs.  The polygons that don't move are rendered at one time only, and
+   those of them in front of the first moving polygon are rendered once per
+   AA sample into a base canvas that every MB sample starts from.  A frame
+   of a single sample is rendered straight into the canvas.
  */
-void Rasterizer::run(const VP& polygons, int frame_num,
-                     bool aa_enabled, int num_aa_samples,
-                     bool mb_enabled, int num_mb_samples,
-                     const std::string& aa_filter) const
+RenderStats Rasterizer::run(const VP& polygons, int frame_num,
+                            bool aa_enabled, int num_aa_samples,
+                            bool mb_enabled, int num_mb_samples,
+                            const std::string& aa_filter,
+                            const Layers* layers) const
 {
-  // set up the accumulation buffer and a scratch pad canvas;
-  Abuffer abuf(width, height);
-  Rasterizer pad(width, height);
+  RenderSettings settings(aa_enabled, num_aa_samples,
+                          mb_enabled, num_mb_samples, aa_filter);
+  return run(polygons, frame_num, settings, layers);
+}
+
+RenderStats Rasterizer::run(const VP& polygons, int frame_num,
+                            const RenderSettings& settings,
+                            const Layers* layers, Profile* profile) const
+{
+  TRACE_SCOPE("Rasterizer::run");
+  auto before = Allocations::mark();
+  auto stats = render(polygons, frame_num, settings, layers, profile);
+  auto& after = Allocations::current;
+  stats.allocations = after.count - before.count;
+  stats.allocated = after.bytes - before.bytes;
+  stats.peak = std::max<int64_t>(after.peak - before.live, 0);
+  return stats;
+}
+
+RenderStats Rasterizer::render(const VP& polygons, int frame_num,
+                               const RenderSettings& settings,
+                               const Layers* layers, Profile* profile) const
+{
+  RenderStats stats;
+  stats.frame = frame_num;
+  packed = false;
+  auto budgeted = settings.budget > 0;
+  auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(settings.budget));
+  if (profile) {
+    if (profile->costs.size() < polygons.size()) {
+      profile->costs.resize(polygons.size());
+    }
+    if (profile->heatmap && (left < profile->left || top < profile->top ||
+                             left + width > profile->left + profile->width ||
+                             top + height > profile->top + profile->height)) {
+      profile->left = left;
+      profile->top = top;
+      profile->width = width;
+      profile->height = height;
+      profile->writes.assign(size_t(width) * height, 0);
+    }
+    stats.profile = profile;
+  }
+  // the polygons [first, last) are not in the cached layers.
+  auto first = layers ? layers->below : 0;
+  auto last = polygons.size() - (layers ? layers->above : 0);
+  if (first == last && layers) {
+    auto start = Clock::now();
+    reset(layers, nullptr);
+    lap(stats.resolve, start);
+    return stats;
+  }
+
   // precomputed shift distances for vertices in AA.
   Point aajitter[8][8];
   int tiles = 1;
-  float frame_shift = 0.0;
-  float frame_offset = 0.0;
+  auto num_aa_samples = settings.num_aa_samples;
+  auto weight_fun = settings.weight_fun;
 
-  if (!aa_enabled) {
-    num_aa_samples = 1;
-  }
   if (num_aa_samples > 1) {
     // don't do more than MAX_SAMPLES:
     tiles = ceil(sqrt(num_aa_samples < MAX_SAMPLES ?
                       num_aa_samples : MAX_SAMPLES));
   }
-  if (!aa_filter.empty()) {
-    parse_aafilter_func(aa_filter);
+  precompute_shifts(aajitter, tiles, settings);
+
+  auto shots = make_shots(frame_num, settings.num_mb_samples, weight_fun);
+
+  std::vector<bool> moving(polygons.size());
+  auto groups = group_shots(polygons, shots, moving);
+  // the polygons that don't move are rendered in the middle of the shutter.
+  float still = 0.0f;
+  int weight = 0;
+  for (auto& s : shots) {
+    still += s.frame * s.weight;
+    weight += s.weight;
   }
-  if (!mb_enabled) {
-    num_mb_samples = 1;
+  still = (groups.size() == 1) ? groups[0].frame : still / weight;
+  // the polygons [first, statics) are rendered into the base canvas.
+  auto statics = first;
+  if (groups.size() > 1) {
+    while (statics < last && !moving[statics]) {
+      ++statics;
+    }
   }
-  if (num_mb_samples > 1) {
-    frame_offset = 1.0 / (2.0 * (float)num_mb_samples) - 0.5;
-    frame_shift = 1.0 / (float)num_mb_samples;
+  std::vector<float> frames(polygons.size(), still);
+  // with a single sample there is nothing to accumulate.
+  if (tiles == 1 && groups.size() == 1) {
+    reset(layers, nullptr);
+    renderSample(polygons, first, last, frames, aajitter[0][0], nullptr,
+                 settings.halfspace, &stats);
+    stats.passes = 1;
+    stats.planned = 1;
+    return stats;
   }
-  precompute_shifts(aajitter, tiles);
+
+  // set up the accumulation buffer and a scratch pad canvas;
+  Abuffer abuf(width, height);
+  Rasterizer pad(width, height);
+  auto based = (statics > first);
+  Rasterizer base(based ? width : 0, based ? height : 0);
+  pad.setOrigin(left, top);
+  base.setOrigin(left, top);
+  stats.memory = sizeof(RGB32) * (abuf.size + abuf.columns * abuf.rows) +
+                 pad.getFootprint() + base.getFootprint();
 
   int samples = 0;
-  int yyfilt = 1;
-  int scans = 0;
+  Mask mask(height);
+  const Mask* pmask = nullptr;
+  stats.planned = tiles * tiles * groups.size();
+  // the AA sample positions row by row, or with a time budget spread over
+  // the pixel in every prefix of the passes, as the MB samples are spread
+  // over the shutter.
+  std::vector<int> positions(tiles * tiles);
+  std::iota(positions.begin(), positions.end(), 0);
+  if (budgeted) {
+    positions = spread(tiles, 2);
+    decltype(groups) spread_groups;
+    for (auto g : spread(groups.size(), 1)) {
+      spread_groups.push_back(groups[g]);
+    }
+    groups.swap(spread_groups);
+  }
+  // at least one pass is taken when the time is up.
+  auto late = [&]() {
+    return budgeted && samples > 0 && Clock::now() >= deadline;
+  };
 
-  for (int jj = 0; jj < tiles; ++jj) {
-    int xxfilt = 1;
-    for (int ii = 0; ii < tiles; ++ii) {
-      int aafilt = yyfilt * xxfilt;
-      int mbfilt = 1;
-      for (int mov = 0; mov < num_mb_samples; ++mov) {
-        float frame = (float)frame_num + frame_offset + frame_shift * mov;
-        if (frame < 1.0) {
-          mbfilt += filter(mov + 1, num_mb_samples);
-          continue;
-        }
-        pad.clear();
-        for (auto& p : polygons) {
-          // make sure it hasn't gone beyond the last frame
-          float max_frame = (p->keyframes.end() - 1)->number;
-          float adj_frame = (frame > max_frame) ? max_frame : frame;
-          // Here we grab the vertices for this object at this snapshot in time
-          std::vector<Point> vertices;
-          RGB8 color = p->getVertices(adj_frame, vertices);
-
-          // shift vertices
-          for (auto& v : vertices) {
-            v += aajitter[ii][jj];
+  // render and accumulate all MB samples at one AA sample position.
+  auto render = [&](const Point& shift, int aafilt) {
+    TRACE_SCOPE("sample");
+    if (based) {
+      base.reset(layers, pmask);
+      base.renderSample(polygons, first, statics, frames, shift, pmask,
+                        settings.halfspace, &stats);
+    }
+    for (auto& g : groups) {
+      if (late()) {
+        return;
+      }
+      for (auto i = statics; i < last; ++i) {
+        frames[i] = moving[i] ? g.frame : still;
+      }
+      if (based) {
+        pad.copy(base.pixels.get(), base.tiles.get(), pmask);
+      } else {
+        pad.reset(layers, pmask);
+      }
+      pad.renderSample(polygons, statics, last, frames, shift, pmask,
+                       settings.halfspace, &stats);
+      // accumulate:
+      TRACE_SCOPE("accumulate");
+      auto start = Clock::now();
+      ++stats.passes;
+      if (pmask) {
+        auto weight = g.weight * aafilt;
+        for (int y = 0; y < height; ++y) {
+          for (auto& r : mask.lines[y]) {
+            layout.runs(y, r.first, r.second,
+                        [&](size_t first, size_t last) {
+                          abuf.add(pad.pixels.get(), first, last, weight);
+                        });
           }
-          pad.scanConvert(vertices, color);
-          ++scans;
         }
-        // accumulate:
-        abuf.add(pad.pixels.get(), width * height, mbfilt * aafilt);
+      } else {
+        abuf.add(pad.pixels.get(), pad.tiles.get(), g.weight * aafilt);
         // done with another sample:
-        samples += mbfilt * aafilt;
-        mbfilt += filter(mov + 1, num_mb_samples);
+        samples += g.weight * aafilt;
+      }
+      lap(stats.accumulate, start);
+    }
+  };
+
+  // the adaptive passes count only when all of them are taken.
+  if (settings.adaptive && tiles > 1 && !budgeted) {
+    // the total weight of all AA samples taken at one MB sample time.
+    int aaweight = 0;
+    int aafilt = 1;
+    for (int ii = 0; ii < tiles; ++ii) {
+      aaweight += aafilt;
+      aafilt += filter(weight_fun, ii + 1, tiles);
+    }
+    render(Point(), aaweight * aaweight);
+    auto start = Clock::now();
+    abuf.get(pixels.get(), layout.size(), samples);
+    find_edges(pixels.get(), layout, mask);
+    abuf.flatten();
+    // the pixels near edges are accumulated again from scratch.
+    for (int y = 0; y < height; ++y) {
+      for (auto& r : mask.lines[y]) {
+        layout.runs(y, r.first, r.second, [&abuf](size_t first, size_t last) {
+          abuf.clear(first, last);
+        });
       }
-      xxfilt += filter(ii + 1, tiles);
+      stats.memory += mask.lines[y].capacity() * sizeof(Mask::Run);
     }
-    yyfilt += filter(jj + 1, tiles);
+    pmask = &mask;
+    lap(stats.resolve, start);
+  }
+
+  // the filter weights of the AA sample rows and columns.
+  std::vector<int> filt(tiles, 1);
+  for (int ii = 1; ii < tiles; ++ii) {
+    filt[ii] = filt[ii - 1] + filter(weight_fun, ii, tiles);
+  }
+  // in adaptive mode there is nothing left to do if no edges were found.
+  for (auto c : positions) {
+    if ((pmask && !mask.count) || late()) {
+      break;
+    }
+    auto ii = c % tiles;
+    auto jj = c / tiles;
+    render(aajitter[ii][jj], filt[jj] * filt[ii]);
   }
 
   assert(samples != 0);
 
-  clear();
   // convert accumulation buffer to RGB8 and copy to the render canvas.
-  abuf.get(pixels.get(), height * width, samples);
+  TRACE_SCOPE("resolve");
+  auto start = Clock::now();
+  // the output is packed with the resolve if it was asked for before.
+  abuf.get(pixels.get(), layout.size(), samples, rgb.get());
+  packed = rgb != nullptr;
+  mix();
+  lap(stats.resolve, start);
+  return stats;
+}
+
+uint64_t Rasterizer::signature(const VP& polygons, int frame_num,
+                               bool aa_enabled, int num_aa_samples,
+                               bool mb_enabled, int num_mb_samples,
+                               const std::string& aa_filter) const
+{
+  if (!aa_enabled) {
+    num_aa_samples = 1;
+  }
+  if (!mb_enabled) {
+    num_mb_samples = 1;
+  }
+  uint64_t h = 0xcbf29ce484222325ULL;
+  h = hash(h, &num_aa_samples, sizeof(num_aa_samples));
+  h = hash(h, &num_mb_samples, sizeof(num_mb_samples));
+  h = hash(h, aa_filter.data(), aa_filter.size());
+  std::vector<Point> vertices;
+  RenderSettings settings(aa_enabled, num_aa_samples,
+                          mb_enabled, num_mb_samples, aa_filter);
+  for (auto& shot : make_shots(frame_num, num_mb_samples,
+                               settings.weight_fun)) {
+    h = hash(h, &shot.weight, sizeof(shot.weight));
+    for (auto& p : polygons) {
+      vertices.clear();
+      auto color = p->getVertices(shot.frame, vertices);
+      h = hash(h, &color.pixel, sizeof(color.pixel));
+      h = hash(h, vertices.data(), vertices.size() * sizeof(Point));
+    }
+  }
+  return h;
+}
+
+void Rasterizer::cache(const VP& polygons, int first, int last,
+                       bool aa_enabled, int num_aa_samples,
+                       const std::string& aa_filter, Layers& layers) const
+{
+  // a polygon is still if it doesn't move during any frame's shutter.
+  auto still = [&polygons, first, last](size_t i) {
+    return 0.0f == polygons[i]->getDisplacement(first - 0.5f, last + 0.5f);
+  };
+  auto size = polygons.size();
+  layers = Layers();
+  while (layers.below < size && still(layers.below)) {
+    ++layers.below;
+  }
+  while (layers.below + layers.above < size &&
+         still(size - 1 - layers.above)) {
+    ++layers.above;
+  }
+  // the pixels a polygon covers during the frames, with the shift of the AA
+  // samples and the neighbours the adaptive AA looks at.  The resolved
+  // background stands for all of its samples only where no other polygon
+  // comes, and it's drawn below all of them.
+  static const float MARGIN = 3.0f;
+  std::vector<std::pair<Point, Point>> bounds(size);
+  for (size_t i = 0; i < size; ++i) {
+    polygons[i]->getBounds(first - 0.5f, last + 0.5f,
+                           bounds[i].first, bounds[i].second);
+  }
+  auto apart = [&bounds](size_t i, size_t j) {
+    auto& a = bounds[i];
+    auto& b = bounds[j];
+    return a.second.x + 2 * MARGIN < b.first.x ||
+           b.second.x + 2 * MARGIN < a.first.x ||
+           a.second.y + 2 * MARGIN < b.first.y ||
+           b.second.y + 2 * MARGIN < a.first.y;
+  };
+  // the cached polygons near one that isn't are not cached either, until
+  // none are left near.
+  for (auto changed = true; changed; ) {
+    changed = false;
+    for (auto j = layers.below; j < size - layers.above; ++j) {
+      for (size_t i = 0; i < layers.below; ++i) {
+        if (!apart(i, j)) {
+          layers.below = i;
+          changed = true;
+        }
+      }
+      for (auto i = size - layers.above; i < size; ++i) {
+        if (!apart(i, j)) {
+          layers.above = size - 1 - i;
+          changed = true;
+        }
+      }
+    }
+  }
+  if (!layers.below && !layers.above) {
+    return;
+  }
+  // the layers are rendered with the same AA settings as the frames.
+  VP cached(polygons.cbegin(), polygons.cbegin() + layers.below);
+  cached.insert(cached.end(), polygons.cend() - layers.above, polygons.cend());
+  Rasterizer layer(width, height);
+  layer.setOrigin(left, top);
+  layer.run(cached, first, aa_enabled, num_aa_samples, false, 1, aa_filter);
+  layer.classify();
+  layers.background = std::move(layer.pixels);
+  layers.tiles = std::move(layer.tiles);
+}
+
+void Rasterizer::classify() const
+{
+  auto columns = getColumns();
+  for (int ty = 0; ty < getRows(); ++ty) {
+    auto y1 = std::min((ty + 1) * TILE_SIZE, height);
+    for (int tx = 0; tx < columns; ++tx) {
+      auto x0 = tx * TILE_SIZE;
+      auto x1 = std::min(x0 + TILE_SIZE, width);
+      auto tag = pixels[layout.index(x0, ty * TILE_SIZE)];
+      auto* p = pixels.get();
+      for (auto y = ty * TILE_SIZE; y < y1 && tag.pixel != MIXED_TILE; ++y) {
+        layout.runs(y, x0, x1 - 1, [p, &tag](size_t first, size_t last) {
+          if (std::any_of(p + first, p + last, [tag](RGB8 c) {
+                return c.pixel != tag.pixel;
+              })) {
+            tag = MIXED_TILE;
+          }
+        });
+      }
+      tiles[tx + ty * columns] = tag;
+    }
+  }
+}
+
+/**
+   \brief scan-convert the polygons [first, last) shifted by <shift> into this
+          canvas, every polygon at its own time in <frames>, and count the
+          work in the <stats>.
+ */
+void Rasterizer::renderSample(const VP& polygons, size_t first, size_t last,
+                             const std::vector<float>& frames,
+                             const Point& shift, const Mask* mask,
+                             bool halfspace, RenderStats* stats) const
+{
+  auto start = Clock::now();
+  for (auto i = first; i < last; ++i) {
+    auto before = *stats;
+    auto& p = polygons[i];
+    // make sure it hasn't gone beyond the last frame
+    float max_frame = (p->keyframes.end() - 1)->number;
+    float adj_frame = (frames[i] > max_frame) ? max_frame : frames[i];
+    // Here we grab the vertices for this object at this snapshot in time
+    std::vector<Point> vertices;
+    RGB8 color = p->getVertices(adj_frame, vertices);
+
+    // shift vertices, and move them to this canvas if it's a band or a crop.
+    Point lo{std::numeric_limits<float>::max(),
+             std::numeric_limits<float>::max()};
+    Point hi{std::numeric_limits<float>::lowest(),
+             std::numeric_limits<float>::lowest()};
+    for (auto& v : vertices) {
+      v += shift;
+      v.x -= left;
+      v.y -= top;
+      lo.x = std::min(lo.x, v.x);
+      lo.y = std::min(lo.y, v.y);
+      hi.x = std::max(hi.x, v.x);
+      hi.y = std::max(hi.y, v.y);
+    }
+    lap(stats->interpolate, start);
+    // the polygons beside the canvas cover no pixels of it.
+    if (hi.x < 0 || lo.x >= width || hi.y < 0 || lo.y >= height) {
+      continue;
+    }
+    ++stats->polygons;
+    stats->active = 0;
+    stats->scratch = 0;
+    if (halfspace && isConvex(vertices)) {
+      scanConvertConvex(vertices, color, mask, stats);
+    } else {
+      scanConvert(vertices, color, mask, stats);
+    }
+    if (stats->profile) {
+      auto& cost = stats->profile->costs[i];
+      cost.time += stats->interpolate + stats->setup + stats->scan -
+                   before.interpolate - before.setup - before.scan;
+      ++cost.samples;
+      cost.edges += stats->edges - before.edges;
+      cost.active = std::max(cost.active, stats->active);
+      cost.pixels += stats->pixels - before.pixels;
+    }
+    stats->active = std::max(stats->active, before.active);
+    stats->scratch = std::max(stats->scratch +
+                              vertices.capacity() * sizeof(Point),
+                              before.scratch);
+    start = Clock::now();
+  }
 }
 
-void Rasterizer::scanConvert(std::vector<Point>& vertex, RGB8 color) const
+void Rasterizer::scanConvertFloat(std::vector<Point>& vertex, RGB8 color,
+                                  const Mask* mask, RenderStats* stats) const
 {
+  packed = false;
   // NO VERTICES TO SCAN
   if (vertex.empty()) {
     return;
@@ -229,18 +897,9 @@ void Rasterizer::scanConvert(std::vector<Point>& vertex, RGB8 color) const
 
     for (auto li = aet.begin(), E = aet.end(); li != E; ++li) {
       if (parity) {
-        // scissor
-        if (0 <= line && line < height) {
-          auto lj = li;
-          ++lj;
-
-          for (int xx = (int)ceilf(li->xx); xx <= lj->xx; ++xx) {
-            // scissor
-            if (0 <= xx && xx < width) {
-              pixels[xx + line * width] = color;
-            }
-          }
-        }
+        auto lj = li;
+        ++lj;
+        fillSpan(line, (int)ceilf(li->xx), (int)floorf(lj->xx), color, mask, stats);
         parity = false;
       } else {
         parity = true;
@@ -249,51 +908,522 @@ void Rasterizer::scanConvert(std::vector<Point>& vertex, RGB8 color) const
       li->xx += li->kk;
     }
   }
+} // scan_convert_float
+
+void Rasterizer::scanConvert(std::vector<Point>& vertex, RGB8 color,
+                             const Mask* mask, RenderStats* stats) const
+{
+  TRACE_DETAIL("Rasterizer::scanConvert");
+  packed = false;
+  auto vertno = vertex.size();
+  // NO VERTICES TO SCAN
+  if (vertno == 0) {
+    return;
+  }
+  auto start = stats ? Clock::now() : Clock::time_point();
+
+  // build the edge table of the edges crossing the canvas lines.
+  std::vector<FixedEdge> edge_table;
+  edge_table.reserve(vertno);
+  for (decltype(vertno) ii = 0; ii < vertno; ++ii) {
+    auto jj = (ii + 1) % vertno;
+    clip_edge(vertex[ii], vertex[jj],
+              [this, &edge_table](int64_t x0, int64_t y0,
+                                  int64_t x1, int64_t y1) {
+      FixedEdge edge;
+      // do not add horizontal edges to the edge table.
+      if ((y0 < y1 && add_fixed_edge(x0, y0, x1, y1, height, edge)) ||
+          (y0 > y1 && add_fixed_edge(x1, y1, x0, y0, height, edge))) {
+        edge_table.push_back(edge);
+      }
+    });
+  }
+  std::sort(edge_table.begin(), edge_table.end(),
+            [](const FixedEdge& a, const FixedEdge& b) {
+              return a.ymin < b.ymin;
+            });
+  if (stats) {
+    lap(stats->setup, start);
+    stats->edges += edge_table.size();
+  }
+
+  // active edge table
+  std::vector<FixedEdge> aet;
+  auto next = edge_table.cbegin();
+  auto E = edge_table.cend();
+  // the runs covered on all lines of the current tile row so far, and the
+  // runs of the current line.
+  std::vector<Mask::Run> cover;
+  std::vector<Mask::Run> spans;
+  std::vector<Mask::Run> common;
+  auto covered = false;
+
+  for (int line = 0; next != E || !aet.empty(); ++line) {
+    if (aet.empty()) {
+      line = next->ymin;
+    }
+    // move from ET to AET the edges starting on this line
+    for (; next != E && next->ymin == line; ++next) {
+      aet.push_back(*next);
+    }
+    // delete from AET the edges ending on this line
+    aet.erase(std::remove_if(aet.begin(), aet.end(),
+                             [line](const FixedEdge& edge) {
+                               return edge.ymax <= line;
+                             }), aet.end());
+    assert(aet.size() % 2 == 0);
+    if (stats) {
+      stats->active = std::max(stats->active, aet.size());
+    }
+    // the edges swap places only when they cross, insertion sort is enough.
+    for (size_t ii = 1; ii < aet.size(); ++ii) {
+      for (auto jj = ii; jj > 0 && aet[jj] < aet[jj - 1]; --jj) {
+        std::swap(aet[jj], aet[jj - 1]);
+      }
+    }
+    // fill in the spans between pairs of edges
+    spans.clear();
+    for (size_t ii = 0; ii + 1 < aet.size(); ii += 2) {
+      auto x0 = aet[ii].x + (aet[ii].f > 0 ? 1 : 0);
+      auto x1 = aet[ii + 1].x;
+      fillSpan(line, x0, x1, color, mask, stats);
+      x0 = std::max<int64_t>(x0, 0);
+      x1 = std::min<int64_t>(x1, width - 1);
+      if (x0 <= x1) {
+        spans.emplace_back(x0, x1);
+      }
+    }
+    // the tiles covered on all their lines are uniform.
+    if (!mask) {
+      if (line % TILE_SIZE == 0) {
+        cover.swap(spans);
+        covered = true;
+      } else if (covered) {
+        common.clear();
+        for (auto a = cover.cbegin(), b = spans.cbegin();
+             a != cover.cend() && b != spans.cend();) {
+          auto x0 = std::max(a->first, b->first);
+          auto x1 = std::min(a->second, b->second);
+          if (x0 <= x1) {
+            common.emplace_back(x0, x1);
+          }
+          if (a->second < b->second) {
+            ++a;
+          } else {
+            ++b;
+          }
+        }
+        cover.swap(common);
+      }
+      if (covered && (line % TILE_SIZE == TILE_SIZE - 1 ||
+                      line == height - 1)) {
+        fillTiles(line, cover, color);
+      }
+      covered = covered && !cover.empty() && line % TILE_SIZE != TILE_SIZE - 1;
+    }
+    // for each edge in AET update x for the new y.
+    for (auto& edge : aet) {
+      edge.next();
+    }
+  }
+  if (stats) {
+    lap(stats->scan, start);
+    auto runs = cover.capacity() + spans.capacity() + common.capacity();
+    stats->scratch = std::max(stats->scratch,
+                              edge_table.capacity() * sizeof(FixedEdge) +
+                              aet.capacity() * sizeof(FixedEdge) +
+                              runs * sizeof(Mask::Run));
+  }
 } // scan_convert
 
+void Rasterizer::scanConvertConvex(std::vector<Point>& vertex, RGB8 color,
+                                   const Mask* mask, RenderStats* stats) const
+{
+  TRACE_DETAIL("Rasterizer::scanConvertConvex");
+  packed = false;
+  static const int BLOCK = 8;
+  auto vertno = vertex.size();
+  // the edges beyond the LIMIT are clipped by the scan line algorithm.
+  if (vertno < 3 || !std::all_of(vertex.cbegin(), vertex.cend(), in_limit)) {
+    scanConvert(vertex, color, mask, stats);
+    return;
+  }
+  auto begin = stats ? Clock::now() : Clock::time_point();
+  std::vector<HalfSpace> edges(vertno);
+  for (decltype(vertno) ii = 0; ii < vertno; ++ii) {
+    edges[ii].x = to_fixed(vertex[ii].x);
+    edges[ii].y = to_fixed(vertex[ii].y);
+  }
+  // the polygon must turn the same way at every vertex and go around once
+  // after rounding, otherwise it's left to the general algorithm.
+  int64_t turn = 0;
+  int64_t direction = 0;
+  auto flips = 0;
+  for (decltype(vertno) ii = 0; ii < 2 * vertno; ++ii) {
+    auto& p = edges[ii % vertno];
+    auto& q = edges[(ii + 1) % vertno];
+    auto& r = edges[(ii + 2) % vertno];
+    auto dx = q.x - p.x;
+    auto cross = dx * (r.y - q.y) - (q.y - p.y) * (r.x - q.x);
+    if ((cross > 0 && turn < 0) || (cross < 0 && turn > 0)) {
+      scanConvert(vertex, color, mask, stats);
+      return;
+    }
+    if (cross != 0) {
+      turn = cross;
+    }
+    // count the flips of the direction along x over the second round only
+    if (ii >= vertno && ((dx > 0 && direction < 0) ||
+                         (dx < 0 && direction > 0))) {
+      ++flips;
+    }
+    if (dx != 0) {
+      direction = dx;
+    }
+  }
+  if (turn == 0 || flips > 2) {
+    scanConvert(vertex, color, mask, stats);
+    return;
+  }
+  int64_t sign = (turn > 0) ? 1 : -1;
+
+  // the same pixels as the scan line algorithm covers: the lines
+  // [ceil(ymin), ceil(ymax)) and the columns [ceil(xmin), floor(xmax)].
+  auto xmin = edges[0].x;
+  auto xmax = xmin;
+  auto ymin = edges[0].y;
+  auto ymax = ymin;
+  for (auto& edge : edges) {
+    xmin = std::min(xmin, edge.x);
+    xmax = std::max(xmax, edge.x);
+    ymin = std::min(ymin, edge.y);
+    ymax = std::max(ymax, edge.y);
+  }
+  auto left = std::max(-floor_div(-xmin, FIXED_ONE), int64_t(0));
+  auto right = std::min(floor_div(xmax, FIXED_ONE), int64_t(width - 1));
+  auto top = std::max(-floor_div(-ymin, FIXED_ONE), int64_t(0));
+  auto bottom = std::min(-floor_div(-ymax, FIXED_ONE), int64_t(height));
+  if (left > right || top >= bottom) {
+    return;
+  }
+
+  for (decltype(vertno) ii = 0; ii < vertno; ++ii) {
+    auto& edge = edges[ii];
+    auto& next = edges[(ii + 1) % vertno];
+    auto dx = next.x - edge.x;
+    auto dy = next.y - edge.y;
+    edge.a = -sign * dy * FIXED_ONE;
+    edge.b = sign * dx * FIXED_ONE;
+    edge.c = sign * (dy * edge.x - dx * edge.y);
+    edge.lo = (std::min(edge.a, int64_t(0)) + std::min(edge.b, int64_t(0))) *
+              (BLOCK - 1);
+    edge.hi = (std::max(edge.a, int64_t(0)) + std::max(edge.b, int64_t(0))) *
+              (BLOCK - 1);
+  }
+
+  if (stats) {
+    lap(stats->setup, begin);
+    stats->edges += vertno;
+  }
+
+  // the pixels found inside are collected into runs on every line of a row
+  // of blocks, and the runs are filled when they can't grow any longer.
+  int64_t start[BLOCK], end[BLOCK];
+  auto emit = [&](int64_t y, int64_t x0, int64_t x1) {
+    auto& s = start[y % BLOCK];
+    auto& e = end[y % BLOCK];
+    if (s <= e && x0 != e + 1) {
+      fillSpan(y, s, e, color, mask, stats);
+      s = x0;
+    } else if (s > e) {
+      s = x0;
+    }
+    e = x1;
+  };
+
+  std::vector<HalfSpace*> crossing;
+  crossing.reserve(vertno);
+  for (auto by = top; by < bottom; by += BLOCK) {
+    auto ey = std::min(by + BLOCK, bottom) - 1;
+    std::fill(start, start + BLOCK, 1);
+    std::fill(end, end + BLOCK, 0);
+    // the columns [full, bx) of the consecutive blocks entirely inside.
+    auto full = right + 1;
+    auto flush = [&](int64_t bx) {
+      for (auto y = by; full < bx && y <= ey; ++y) {
+        emit(y, full, bx - 1);
+      }
+      full = right + 1;
+    };
+    // the edge functions in the top left pixel of the block.
+    for (auto& edge : edges) {
+      edge.e = edge.a * left + edge.b * by + edge.c;
+    }
+    auto entered = false;
+    for (auto bx = left; bx <= right; bx += BLOCK) {
+      auto ex = std::min(bx + BLOCK - 1, right);
+      // trivially accept or reject the block by the pixels where the edge
+      // functions are the smallest and the largest.
+      auto reject = false;
+      crossing.clear();
+      for (auto& edge : edges) {
+        if (edge.e + edge.lo < 0) {
+          crossing.push_back(&edge);
+        }
+        reject = reject || (edge.e + edge.hi < 0);
+      }
+      if (stats) {
+        stats->active = std::max(stats->active, crossing.size());
+      }
+      auto accept = crossing.empty();
+      if (accept) {
+        full = std::min(full, bx);
+      } else {
+        flush(bx);
+      }
+      if (reject && entered) {
+        // the rest of the row is outside the convex polygon.
+        break;
+      }
+      entered = entered || !reject;
+      for (auto y = by; !accept && !reject && y <= ey; ++y) {
+        // the pixels [lo, hi] of the line in the block are inside all the
+        // edges crossing the block, E(x) = e + a * x >= 0.
+        int64_t lo = 0;
+        int64_t hi = ex - bx;
+        for (auto* edge : crossing) {
+          auto e = edge->e + edge->b * (y - by);
+          if (edge->a > 0) {
+            lo = std::max(lo, -floor_div(e, edge->a));
+          } else if (edge->a < 0) {
+            hi = std::min(hi, floor_div(e, -edge->a));
+          } else if (e < 0) {
+            hi = -1;
+          }
+        }
+        if (lo <= hi) {
+          emit(y, bx + lo, bx + hi);
+        }
+      }
+      for (auto& edge : edges) {
+        edge.e += edge.a * BLOCK;
+      }
+    }
+    flush(right + 1);
+    for (auto y = by; y <= ey; ++y) {
+      if (start[y % BLOCK] <= end[y % BLOCK]) {
+        fillSpan(y, start[y % BLOCK], end[y % BLOCK], color, mask, stats);
+      }
+    }
+  }
+  if (stats) {
+    lap(stats->scan, begin);
+    stats->scratch = std::max(stats->scratch,
+                              edges.capacity() * sizeof(HalfSpace) +
+                              crossing.capacity() * sizeof(HalfSpace*));
+  }
+} // scan_convert_convex
+
+/**
+   \brief fill the pixels [x0, x1] of the <line> clipped to the canvas and
+          to the runs of the <mask> if any.
+ */
+void Rasterizer::fillSpan(int line, int x0, int x1, RGB8 color,
+                          const Mask* mask, RenderStats* stats) const
+{
+  // scissor
+  if (line < 0 || line >= height) {
+    return;
+  }
+  x0 = std::max(x0, 0);
+  x1 = std::min(x1, width - 1);
+  if (x0 > x1) {
+    return;
+  }
+  auto* t = tiles.get() + line / TILE_SIZE * getColumns();
+  std::fill(t + x0 / TILE_SIZE, t + x1 / TILE_SIZE + 1, MIXED_TILE);
+  auto* p = pixels.get();
+  auto& kernels = Kernels::get();
+  auto fill = [p, color, &kernels](size_t first, size_t last) {
+    kernels.fill(p + first, last - first, color);
+  };
+  // the heatmap is stored line by line.
+  uint32_t* writes = nullptr;
+  if (stats) {
+    ++stats->spans;
+    auto* profile = stats->profile;
+    if (profile && !profile->writes.empty()) {
+      writes = profile->writes.data() +
+               size_t(line + top - profile->top) * profile->width +
+               (left - profile->left);
+    }
+  }
+  if (!mask) {
+    layout.runs(line, x0, x1, fill);
+    if (stats) {
+      stats->pixels += x1 - x0 + 1;
+    }
+    for (auto x = x0; writes && x <= x1; ++x) {
+      ++writes[x];
+    }
+    return;
+  }
+  for (auto& r : mask->lines[line]) {
+    if (r.second < x0) {
+      continue;
+    }
+    if (r.first > x1) {
+      break;
+    }
+    auto s = std::max(r.first, x0);
+    auto e = std::min(r.second, x1);
+    layout.runs(line, s, e, fill);
+    if (stats) {
+      stats->pixels += e - s + 1;
+    }
+    for (auto x = s; writes && x <= e; ++x) {
+      ++writes[x];
+    }
+  }
+}
+
+/**
+   \brief tag as uniform in the <color> the tiles in the row of the <line>
+          that lie inside the <cover> runs filled on all lines of the row.
+ */
+void Rasterizer::fillTiles(int line, const std::vector<Mask::Run>& cover,
+                           RGB8 color) const
+{
+  auto* t = tiles.get() + line / TILE_SIZE * getColumns();
+  for (auto& r : cover) {
+    for (auto tx = (r.first + TILE_SIZE - 1) / TILE_SIZE;
+         tx * TILE_SIZE <= r.second; ++tx) {
+      if (std::min((tx + 1) * TILE_SIZE, width) - 1 <= r.second) {
+        t[tx] = color;
+      }
+    }
+  }
+}
+
+std::ostream& operator<<(std::ostream& os, const RenderStats& stats)
+{
+  auto ms = [](double seconds) { return seconds * 1000; };
+  return os << "{\"frame\": " << stats.frame
+            << ", \"interpolate_ms\": " << ms(stats.interpolate)
+            << ", \"setup_ms\": " << ms(stats.setup)
+            << ", \"scan_ms\": " << ms(stats.scan)
+            << ", \"accumulate_ms\": " << ms(stats.accumulate)
+            << ", \"resolve_ms\": " << ms(stats.resolve)
+            << ", \"write_ms\": " << ms(stats.write)
+            << ", \"polygons\": " << stats.polygons
+            << ", \"edges\": " << stats.edges
+            << ", \"active\": " << stats.active
+            << ", \"spans\": " << stats.spans
+            << ", \"pixels\": " << stats.pixels
+            << ", \"passes\": " << stats.passes
+            << ", \"planned\": " << stats.planned
+            << ", \"memory\": " << stats.memory
+            << ", \"scratch\": " << stats.scratch
+            << ", \"allocations\": " << stats.allocations
+            << ", \"allocated\": " << stats.allocated
+            << ", \"peak\": " << stats.peak << "}";
+}
+
+void Profile::report(std::ostream& os, size_t top) const
+{
+  std::vector<size_t> ranks(costs.size());
+  auto total = 0.0;
+  for (size_t i = 0; i < costs.size(); ++i) {
+    ranks[i] = i;
+    total += costs[i].time;
+  }
+  std::stable_sort(ranks.begin(), ranks.end(), [this](size_t a, size_t b) {
+    return costs[a].time > costs[b].time;
+  });
+  if (ranks.size() > top) {
+    ranks.resize(top);
+  }
+  auto flags = os.flags();
+  os << "rank polygon   time_ms  share  samples    edges active    pixels\n";
+  for (size_t r = 0; r < ranks.size(); ++r) {
+    auto& c = costs[ranks[r]];
+    os << std::setw(4) << r + 1 << std::setw(8) << ranks[r]
+       << std::fixed << std::setprecision(3) << std::setw(10) << c.time * 1e3
+       << std::setprecision(1) << std::setw(6)
+       << (total > 0 ? 100 * c.time / total : 0.0) << "%"
+       << std::setw(9) << c.samples << std::setw(9) << c.edges
+       << std::setw(7) << c.active << std::setw(10) << c.pixels << "\n";
+  }
+  os.flags(flags);
+}
+
+bool Profile::saveHeatmap(const std::string& filename) const
+{
+  std::ofstream output(filename, std::ios::binary);
+  if (!output || writes.empty()) {
+    return false;
+  }
+  output << "P6\n# pixel writes\n" << width << " " << height << "\n255\n";
+  auto most = std::max<uint32_t>(1, *std::max_element(writes.cbegin(),
+                                                      writes.cend()));
+  // black through red and yellow to white.
+  for (auto w : writes) {
+    auto heat = 3.0f * w / most;
+    unsigned char rgb[3];
+    for (int c = 0; c < 3; ++c) {
+      auto v = std::min(std::max(heat - c, 0.0f), 1.0f);
+      rgb[c] = static_cast<unsigned char>(v * 255 + 0.5f);
+    }
+    output.write(reinterpret_cast<char*>(rgb), 3);
+  }
+  return bool(output);
+}
+
 void Rasterizer::save(const std::string& filename) const
 {
+  TRACE_SCOPE("Rasterizer::save");
   std::ofstream output(filename, std::ios::binary);
   assert(output);
   // print header
   output << "P6\n# Comment Line\n" << width << " " << height << "\n255\n";
-  // output every pixel as 3 bytes
-  auto* buffer = pixels.get();
-  for (auto i = 0; i < width * height; ++i, ++buffer) {
-    output.write(reinterpret_cast<char*>(buffer), 3);
+  write(output, 0, height);
+}
+
+void Rasterizer::write(std::ostream& output, int first, int lines) const
+{
+  assert(first + lines <= height);
+  // output every line as 3 bytes per pixel
+  output.write(reinterpret_cast<const char*>(getRGB()) +
+               3 * size_t(first) * width, 3 * size_t(width) * lines);
+}
+
+const unsigned char* Rasterizer::getRGB() const
+{
+  if (!rgb) {
+    rgb.reset(new unsigned char[3 * size_t(width) * height]);
   }
+  if (!packed) {
+    auto* t = rgb.get();
+    auto& kernels = Kernels::get();
+    for (int y = 0; y < height; ++y) {
+      layout.runs(y, 0, width - 1, [&](size_t first, size_t last) {
+        kernels.pack(pixels.get() + first, last - first, t);
+        t += 3 * (last - first);
+      });
+    }
+    packed = true;
+  }
+  return rgb.get();
 }
 
 /**
-   \brief Copy the pixel data to an unsigned char array dynamically allocated.
-
-   This function assumes little endian representation of integers,
-   and the address of a block returned by malloc is always a multiple of eight
-   (or sixteen on 64-bit systems).
+   \brief Copy the pixel data line by line to an unsigned char array
+          dynamically allocated.
  */
 unsigned char* Rasterizer::getPixelsAsRGB() const
 {
-  auto* data = static_cast<unsigned char*>(malloc(width * height * 3));
-  auto* t = reinterpret_cast<unsigned int*>(data);
-  auto i = 0;
-  for (; i < width * height; i += 4) {
-    auto p0 = pixels[i + 0].pixel;
-    auto p1 = pixels[i + 1].pixel;
-    auto p2 = pixels[i + 2].pixel;
-    auto p3 = pixels[i + 3].pixel;
-    t[0] = ((p1 << 24) & 0xff000000) | ( p0        & 0xffffff);
-    t[1] = ((p2 << 16) & 0xffff0000) | ((p1 >>  8) & 0x00ffff);
-    t[2] = ((p3 <<  8) & 0xffffff00) | ((p2 >> 16) & 0x0000ff);
-    t += 3;
-  }
-  if (i != width * height) {
-    for (i -= 3; i < width * height; ++i) {
-      auto p = pixels[i].pixel;
-      auto* t = data + 3 * i;
-      t[0] = (p & 0x0000ff);
-      t[1] = (p & 0x00ff00) >> 0x08;
-      t[2] = (p & 0xff0000) >> 0x10;
-    }
-  }
+  auto bytes = 3 * size_t(width) * height;
+  auto* data = static_cast<unsigned char*>(malloc(bytes));
+  std::copy(getRGB(), getRGB() + bytes, data);
   return data;
 }
@@ -8,18 +8,46 @@
 #ifndef rasterizer_h
 #define rasterizer_h
 
+#include "allocations.h"
+#include "kernels.h"
 #include "polygon.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
 enum class SHIFT_MODE { GRID, RANDOM };
 enum class WEIGHT_FUN { BOX, BARTLETT };
 
+/**
+   \brief RenderSettings hold how a frame is sampled: the numbers of AA and MB
+          samples, the options given by the filter commands and the seed of
+          the random placement of the AA samples.  With a <budget> of
+          seconds per frame the samples are taken in a progressive order
+          until the time is up, the frame is made of the samples taken by
+          then.  The settings are not changed by rendering, so frames can be
+          rendered at the same time.
+*/
+struct RenderSettings {
+  int num_aa_samples;
+  int num_mb_samples;
+  SHIFT_MODE shift_mode;
+  WEIGHT_FUN weight_fun;
+  bool adaptive;
+  bool halfspace;
+  uint32_t seed;
+  double budget;
+
+  RenderSettings(bool aa_enabled = false, int num_aa_samples = 1,
+                 bool mb_enabled = false, int num_mb_samples = 1,
+                 const std::string& aa_filter = "");
+};
+
 struct Edge {
   float yy, xx, kk;
 
@@ -31,6 +59,34 @@ struct Edge {
   }
 };
 
+/**
+   \brief FixedEdge walks an edge from line to line in exact integer
+          arithmetic.  On the current line the edge crosses the point
+          x + f / den pixels, where 0 <= f < den.
+*/
+struct FixedEdge {
+  int64_t x, f, den;
+  // increments of x and f from one line to the next one.
+  int64_t step, rem;
+  // the edge crosses the lines [ymin, ymax).
+  int ymin, ymax;
+
+  bool operator<(const FixedEdge& edge) const {
+    return x < edge.x || (x == edge.x &&
+                          f * static_cast<double>(edge.den) <
+                          edge.f * static_cast<double>(den));
+  }
+
+  void next() {
+    x += step;
+    f += rem;
+    if (f >= den) {
+      f -= den;
+      ++x;
+    }
+  }
+};
+
 class edge_ymax_le : public std::unary_function<Edge, bool>
 {
   float ymax;
@@ -44,30 +100,297 @@ public:
 };
 
 /**
-   \brief Abuffer holds canvas pixels with 32 bits per RGB component.
+   \brief Mask holds for every canvas line the sorted runs of pixels [x0, x1]
+          that need the full set of AA samples in adaptive mode.
+*/
+struct Mask {
+  using Run = std::pair<int, int>;
+  std::vector<std::vector<Run>> lines;
+  size_t count;
+
+  Mask(size_t h = 0) : lines(h), count(0)
+  {}
+};
+
+/**
+   \brief canvases are split into TILE_SIZE x TILE_SIZE tiles.  A tile that is
+          covered by a single color is tagged with the color, the others are
+          tagged MIXED_TILE, so that they can be accumulated in bulk.
+*/
+static const int TILE_SIZE = 16;
+static const unsigned int MIXED_TILE = 0xff000000;
+
+/**
+   \brief Layout maps the pixel (x, y) of a canvas to its index in the arrays
+          of pixels.  The pixels are stored line by line, or if
+          RASTERIZER_TILED is defined tile by tile and every tile line by
+          line, so that a tile is accumulated and classified from the cache.
+          The indexes are 64 bits, a canvas may have more than 2^31 pixels.
+*/
+struct Layout {
+  int width;
+  int height;
+  int columns;
+  int rows;
+
+  Layout(int w = 0, int h = 0)
+    : width(w), height(h)
+    , columns((w + TILE_SIZE - 1) / TILE_SIZE)
+    , rows((h + TILE_SIZE - 1) / TILE_SIZE)
+  {}
+
+  // the number of pixels stored, the tiles on the edges are padded if tiled.
+  size_t size() const {
+#ifdef RASTERIZER_TILED
+    return size_t(columns) * rows * TILE_SIZE * TILE_SIZE;
+#else
+    return size_t(width) * height;
+#endif
+  }
+
+  size_t index(int x, int y) const {
+#ifdef RASTERIZER_TILED
+    return ((size_t(y / TILE_SIZE) * columns + x / TILE_SIZE) * TILE_SIZE +
+            y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+#else
+    return size_t(y) * width + x;
+#endif
+  }
+
+  // call f(first, last) for the ranges of indexes of the pixels [x0, x1] of
+  // the line <y> from left to right.
+  template <typename F>
+  void runs(int y, int x0, int x1, F f) const {
+#ifdef RASTERIZER_TILED
+    while (x0 <= x1) {
+      auto x = std::min((x0 / TILE_SIZE + 1) * TILE_SIZE - 1, x1);
+      auto i = index(x0, y);
+      f(i, i + (x - x0) + 1);
+      x0 = x + 1;
+    }
+#else
+    if (x0 <= x1) {
+      auto i = index(x0, y);
+      f(i, i + (x1 - x0) + 1);
+    }
+#endif
+  }
+};
+
+/**
+   \brief Abuffer holds canvas pixels with 32 bits per RGB component.  The
+          uniform tiles are accumulated once per tile in <tiles>, that is added
+          to every pixel of the tile on get.
 */
 struct Abuffer {
+  Layout layout;
   size_t size;
+  int columns;
+  int rows;
   std::unique_ptr<RGB32[]> pixels;
+  std::unique_ptr<RGB32[]> tiles;
 
-  Abuffer(size_t w = 0, size_t h = 0) : size(w * h), pixels(new RGB32[size])
+  Abuffer(int w = 0, int h = 0)
+    : layout(w, h), size(layout.size())
+    , columns(layout.columns), rows(layout.rows)
+    , pixels(new RGB32[size]), tiles(new RGB32[columns * rows])
   {}
 
   void add(const RGB8* colors, size_t size, unsigned int weight = 1) {
-    assert(size <= this->size);
-    for (size_t x = 0; x < size; ++x) {
-      pixels[x] += RGB32(colors[x]) * weight;
+    add(colors, 0, size, weight);
+  }
+
+  void add(const RGB8* colors, size_t first, size_t last, unsigned int weight) {
+    assert(last <= size);
+    Kernels::get().accumulate(pixels.get() + first, colors + first,
+                              last - first, weight);
+  }
+
+  // accumulate the whole canvas with the tags of its tiles in <uniform>.
+  void add(const RGB8* colors, const RGB8* uniform, unsigned int weight) {
+    auto& kernels = Kernels::get();
+    for (int ty = 0; ty < rows; ++ty) {
+      auto y1 = std::min((ty + 1) * TILE_SIZE, layout.height);
+      for (int tx = 0; tx < columns; ++tx) {
+        auto tag = uniform[tx + ty * columns];
+        if (tag.pixel != MIXED_TILE) {
+          if (tag.pixel) {
+            RGB32 c(tag);
+            tiles[tx + ty * columns] += c * weight;
+          }
+          continue;
+        }
+        auto x0 = tx * TILE_SIZE;
+        auto x1 = std::min(x0 + TILE_SIZE, layout.width) - 1;
+        for (auto y = ty * TILE_SIZE; y < y1; ++y) {
+          layout.runs(y, x0, x1, [&](size_t first, size_t last) {
+            kernels.accumulate(pixels.get() + first, colors + first,
+                               last - first, weight);
+          });
+        }
+      }
     }
   }
 
-  void get(RGB8* p, size_t size, unsigned int k) {
-    assert(size <= this->size);
-    for (size_t x = 0; x < size; ++x) {
-      p[x] = pixels[x].get(k);
+  // move the sums of the uniform tiles to their pixels.
+  void flatten() {
+    for (int y = 0; y < layout.height; ++y) {
+      line_runs(y, [this](size_t first, size_t last, const RGB32& t) {
+        for (auto i = first; i < last; ++i) {
+          pixels[i] += t;
+        }
+      });
+    }
+    std::fill(tiles.get(), tiles.get() + columns * rows, RGB32());
+  }
+
+  void clear(size_t first, size_t last) {
+    assert(last <= size);
+    std::fill(pixels.get() + first, pixels.get() + last, RGB32());
+  }
+
+  /**
+     \brief resolves the sums divided by <k> into the canvas <p>, and if
+            there is an <rgb> buffer also packs every line as 3 bytes R, G, B
+            per pixel into it while the line is in the cache.
+  */
+  void get(RGB8* p, size_t size, unsigned int k,
+           unsigned char* rgb = nullptr) {
+    assert(size == this->size);
+    auto& kernels = Kernels::get();
+    for (int y = 0; y < layout.height; ++y) {
+      line_runs(y, [&](size_t first, size_t last, const RGB32& t) {
+        kernels.resolve(p + first, pixels.get() + first, last - first, t, k);
+      });
+      if (rgb) {
+        auto* q = rgb + 3 * size_t(y) * layout.width;
+        layout.runs(y, 0, layout.width - 1, [&](size_t first, size_t last) {
+          kernels.pack(p + first, last - first, q);
+          q += 3 * (last - first);
+        });
+      }
+    }
+  }
+
+private:
+
+  // call f(first, last, sum) for the ranges of indexes of the line <y> in
+  // every tile with the sum of the tile.
+  template <typename F>
+  void line_runs(int y, F f) const {
+    auto* t = tiles.get() + y / TILE_SIZE * columns;
+    for (int tx = 0; tx < columns; ++tx) {
+      auto x0 = tx * TILE_SIZE;
+      auto x1 = std::min(x0 + TILE_SIZE, layout.width) - 1;
+      layout.runs(y, x0, x1, [&f, t, tx](size_t first, size_t last) {
+        f(first, last, t[tx]);
+      });
     }
   }
 };
 
+/**
+   \brief Layers hold the pre-resolved image of the polygons that don't move
+          during a sequence of frames.  The <below> bottom polygons and the
+          <above> top polygons make the background, the other polygons never
+          come near them.
+*/
+struct Layers {
+  size_t below;
+  size_t above;
+  std::unique_ptr<RGB8[]> background;
+  // the tags of the background tiles.
+  std::unique_ptr<RGB8[]> tiles;
+
+  Layers() : below(0), above(0)
+  {}
+};
+
+/**
+   \brief Profile attributes the work of rendering to the polygons, by their
+          index in the scene, summed over all samples of all frames rendered
+          with it.  The pixel writes are counted per canvas pixel too if
+          <heatmap> is set, over the <width> x <height> pixels from (<left>,
+          <top>) of the canvas.  A render beyond them sets them to its own
+          canvas.
+*/
+struct Profile {
+  struct Cost {
+    double time;
+    size_t samples;
+    size_t edges;
+    size_t active;
+    size_t pixels;
+
+    Cost() : time(0), samples(0), edges(0), active(0), pixels(0)
+    {}
+  };
+
+  std::vector<Cost> costs;
+  bool heatmap;
+  int left;
+  int top;
+  int width;
+  int height;
+  std::vector<uint32_t> writes;
+
+  Profile(bool heatmap = false)
+    : heatmap(heatmap), left(0), top(0), width(0), height(0)
+  {}
+
+  // print the <top> costliest polygons ranked by time.
+  void report(std::ostream& os, size_t top = 20) const;
+  // write the pixel write counts as a PPM image, black for none, white for
+  // the most.
+  bool saveHeatmap(const std::string& filename) const;
+};
+
+/**
+   \brief RenderStats count the work done to render a frame: the wall time in
+          seconds of every phase, the polygons scan-converted in all samples,
+          the edges set up for them and the most of them active on a line, the
+          spans and pixels they filled, the canvases accumulated out of the
+          <planned> ones, fewer if the time budget ran out, the peak
+          bytes of the scratch canvases and buffers and the most bytes of edge
+          tables, active edges and vertices a polygon needed.  Where the heap
+          allocations are counted, see Allocations, the allocations made by
+          the rendering, their bytes and the most bytes live at once are
+          counted as well.  The work of every polygon is added to the
+          <profile> if there is one.
+*/
+struct RenderStats {
+  int frame;
+  double interpolate;
+  double setup;
+  double scan;
+  double accumulate;
+  double resolve;
+  double write;
+  size_t polygons;
+  size_t edges;
+  size_t active;
+  size_t spans;
+  size_t pixels;
+  size_t passes;
+  size_t planned;
+  size_t memory;
+  size_t scratch;
+  size_t allocations;
+  size_t allocated;
+  size_t peak;
+  Profile* profile;
+
+  RenderStats()
+    : frame(0), interpolate(0), setup(0), scan(0), accumulate(0), resolve(0)
+    , write(0), polygons(0), edges(0), active(0), spans(0), pixels(0)
+    , passes(0), planned(0), memory(0), scratch(0), allocations(0), allocated(0), peak(0)
+    , profile(nullptr)
+  {}
+};
+
+// print the <stats> as a JSON object with the times in milliseconds.
+std::ostream& operator<<(std::ostream& os, const RenderStats& stats);
+
 /**
    \class implements the rasterization algorithm on canvas with the objects.
 */
@@ -78,13 +401,26 @@ class Rasterizer {
   std::unique_ptr<RGB8[]> pixels;
   int width;
   int height;
+  Layout layout;
+  // the tags of the tiles, see TILE_SIZE.
+  std::unique_ptr<RGB8[]> tiles;
+  // the pixel of the scene at the top left of the canvas, when the canvas
+  // is a band or a crop of a larger image.
+  int left;
+  int top;
+  // the pixels as 3 bytes R, G, B line by line for the output, allocated
+  // when they are first asked for, and up to date if <packed>.
+  mutable std::unique_ptr<unsigned char[]> rgb;
+  mutable bool packed;
 
 public:
 
   static const auto MAX_SAMPLES = 64;
 
   Rasterizer(int w = 500, int h = 500)
-    : pixels(new RGB8[w * h]), width(w), height(h) {
+    : pixels(new RGB8[Layout(w, h).size()]), width(w), height(h)
+    , layout(w, h), tiles(new RGB8[getColumns() * getRows()])
+    , left(0), top(0), packed(false) {
     clear();
   }
 
@@ -96,32 +432,204 @@ public:
     return height;
   }
 
+  int getLeft() const {
+    return left;
+  }
+
+  int getTop() const {
+    return top;
+  }
+
+  // render the pixels [x, x + width) x [y, y + height) of the scene into the
+  // canvas.
+  void setOrigin(int x, int y) {
+    left = x;
+    top = y;
+  }
+
+  int getColumns() const {
+    return (width + TILE_SIZE - 1) / TILE_SIZE;
+  }
+
+  int getRows() const {
+    return (height + TILE_SIZE - 1) / TILE_SIZE;
+  }
+
+  // the bytes of the canvas, its tile tags and its packed pixels.
+  size_t getFootprint() const {
+    return sizeof(RGB8) * (layout.size() + getColumns() * getRows()) +
+           (rgb ? 3 * size_t(width) * height : 0);
+  }
+
   void resize(int w, int h) {
     width = w;
     height = h;
-    pixels.reset(new RGB8[w * h]);
+    layout = Layout(w, h);
+    pixels.reset(new RGB8[layout.size()]);
+    tiles.reset(new RGB8[getColumns() * getRows()]);
+    rgb.reset();
+    packed = false;
+    mix();
   }
 
   /**
      \brief takes a frame number, and a bunch of arguments showing how the frame
-            should be rasterized.
+            should be rasterized.  The polygons cached in <layers> are not
+            rendered, the rest are rendered over the cached background.
+     \return the statistics of the rendering.
   */
-  void run(const VP& polygons,
+  RenderStats run(const VP& polygons,
            int frame,
            bool aa_enabled, int num_aa_samples,
            bool mb_enabled, int num_mb_samples,
-           const std::string& aa_filter) const;
+           const std::string& aa_filter,
+           const Layers* layers = nullptr) const;
+  /**
+     \brief renders the frame sampled as the <settings> say.  The random shift
+            of every AA sample depends only on the seed and the sample, so
+            the frame looks the same whenever it's rendered.  The
+            work of every polygon is added to the <profile> if there is one.
+  */
+  RenderStats run(const VP& polygons, int frame,
+                  const RenderSettings& settings,
+                  const Layers* layers = nullptr,
+                  Profile* profile = nullptr) const;
+  /**
+     \brief computes a hash of everything that determines how the frame looks:
+            the vertices and colors of the polygons at all MB sample times and
+            the sampling settings.  Frames with equal signatures render the
+            same image, up to the random placement of AA samples.
+  */
+  uint64_t signature(const VP& polygons,
+                     int frame,
+                     bool aa_enabled, int num_aa_samples,
+                     bool mb_enabled, int num_mb_samples,
+                     const std::string& aa_filter) const;
+  /**
+     \brief pre-renders into <layers> the polygons at the bottom and at the top
+            of the list that don't move between the frames <first> and <last>
+            and stay apart from all the others.  Every sample of the others
+            then starts from the same background as without the layers, so
+            the frames are the same.
+  */
+  void cache(const VP& polygons, int first, int last,
+             bool aa_enabled, int num_aa_samples,
+             const std::string& aa_filter, Layers& layers) const;
   void save(const std::string& filename) const;
+  // write the <lines> lines from the <first> one as binary PPM pixels.
+  void write(std::ostream& output, int first, int lines) const;
+  /**
+     \brief the pixels as 3 bytes R, G, B each line by line, packed only if
+            the canvas changed since they were last asked for.  The buffer
+            belongs to the rasterizer and is valid until it's resized.
+  */
+  const unsigned char* getRGB() const;
+  // a copy of getRGB() allocated with malloc.
   unsigned char* getPixelsAsRGB() const;
 
 private:
 
   void clear() const {
     auto* p = pixels.get();
-    std::fill(p, p + width * height, 0);
+    std::fill(p, p + layout.size(), 0);
+    std::fill(tiles.get(), tiles.get() + getColumns() * getRows(), 0);
+  }
+
+  // tag all tiles as mixed, when the pixels are written without the tags.
+  void mix() const {
+    std::fill(tiles.get(), tiles.get() + getColumns() * getRows(),
+              MIXED_TILE);
+  }
+
+  void clear(const Mask* mask) const {
+    if (!mask) {
+      clear();
+      return;
+    }
+    auto* p = pixels.get();
+    for (int y = 0; y < height; ++y) {
+      for (auto& r : mask->lines[y]) {
+        layout.runs(y, r.first, r.second, [p](size_t first, size_t last) {
+          std::fill(p + first, p + last, 0);
+        });
+      }
+    }
+    mix();
+  }
+
+  void copy(const RGB8* src, const RGB8* tags, const Mask* mask) const {
+    if (!mask) {
+      std::copy(src, src + layout.size(), pixels.get());
+      if (tags) {
+        std::copy(tags, tags + getColumns() * getRows(), tiles.get());
+      } else {
+        mix();
+      }
+      return;
+    }
+    auto* p = pixels.get();
+    for (int y = 0; y < height; ++y) {
+      for (auto& r : mask->lines[y]) {
+        layout.runs(y, r.first, r.second, [src, p](size_t first, size_t last) {
+          std::copy(src + first, src + last, p + first);
+        });
+      }
+    }
+    mix();
+  }
+
+  // start a sample from the background of the <layers> if there is one.
+  void reset(const Layers* layers, const Mask* mask) const {
+    if (layers && layers->background) {
+      copy(layers->background.get(), layers->tiles.get(), mask);
+    } else {
+      clear(mask);
+    }
   }
 
-  void scanConvert(std::vector<Point>& vertices, RGB8 color) const;
+  // tag the tiles by the pixels in them.
+  void classify() const;
+  RenderStats render(const VP& polygons, int frame,
+                     const RenderSettings& settings,
+                     const Layers* layers, Profile* profile) const;
+  void renderSample(const VP& polygons, size_t first, size_t last,
+                    const std::vector<float>& frames, const Point& shift,
+                    const Mask* mask, bool halfspace,
+                    RenderStats* stats) const;
+  void fillSpan(int line, int x0, int x1, RGB8 color, const Mask* mask,
+                RenderStats* stats) const;
+  void fillTiles(int line, const std::vector<Mask::Run>& cover,
+                 RGB8 color) const;
+
+public:
+
+  /**
+     \brief fills the polygon with the <vertices> in the <color>, the edges are
+            walked in 24.8 fixed point.  Only the pixels in the <mask> are
+            filled if there is one.  The work is counted in the <stats> if
+            there are any.
+  */
+  void scanConvert(std::vector<Point>& vertices, RGB8 color,
+                   const Mask* mask = nullptr,
+                   RenderStats* stats = nullptr) const;
+  /**
+     \brief fills the convex polygon with the <vertices> in the <color> by
+            testing the pixels against the edge functions of the polygon, the
+            blocks of 8x8 pixels that are entirely inside or outside are
+            filled or skipped without testing the pixels.  Covers exactly the
+            same pixels as scanConvert and falls back to it if the polygon is
+            not convex after the vertices are rounded to fixed point.
+  */
+  void scanConvertConvex(std::vector<Point>& vertices, RGB8 color,
+                         const Mask* mask = nullptr,
+                         RenderStats* stats = nullptr) const;
+  /**
+     \brief is the same as scanConvert but walks the edges in floating point,
+            the reference to compare the fixed point implementation with.
+  */
+  void scanConvertFloat(std::vector<Point>& vertices, RGB8 color,
+                        const Mask* mask = nullptr,
+                        RenderStats* stats = nullptr) const;
 };
 
 #endif /* rasterizer_h */
@@ -6,17 +6,26 @@
 */
 
 #include "scene.h"
+#include "image.h"
+#include "kernels.h"
+#include "trace.h"
 
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <limits>
 #include <ostream>
+#include <random>
 #include <sstream>
 #include <string>
 #include <iostream>
+#include <unistd.h>
 
 bool Scene::load(const std::string& filename)
 {
+  TRACE_SCOPE("Scene::load");
   // check if there's something in the filename field
   std::ifstream infile(filename);
   if (!infile) {
@@ -119,23 +128,126 @@ void Scene::save(const std::string& filename) const
   }
 }
 
-void Scene::renderToFile(const std::vector<std::string>& args)
+// The keyframes of the generated polygons are this many frames apart.
+static const int KEYFRAME_STEP = 10;
+
+void Scene::generate(const StressSpec& spec)
+{
+  // only the raw output of the engine is used, it's the same everywhere.
+  std::mt19937 engine(spec.seed);
+  auto unit = [&engine]() {
+    return static_cast<float>(engine() / 4294967296.0);
+  };
+  auto n = std::max(spec.vertices, 3);
+  auto total = spec.convex + spec.concave + spec.crossing;
+  // the radius that makes the polygons cover the canvas <depth> times.
+  auto radius = static_cast<float>(std::sqrt(spec.depth * width * height /
+                                             (std::max(spec.polygons, 1) *
+                                              M_PI)));
+  polygons.clear();
+  selected = nullptr;
+  active = nullptr;
+  std::vector<float> angles(n);
+  for (int i = 0; i < spec.polygons; ++i) {
+    auto obj = std::make_shared<Polygon>();
+    auto r = engine() % 256;
+    auto g = engine() % 256;
+    obj->setColor(r, g, engine() % 256);
+    // the vertices go around the center in order, except in the
+    // self-intersecting polygons, and every other vertex of the concave
+    // polygons is pulled toward the center.
+    for (auto& a : angles) {
+      a = 2 * M_PI * unit();
+    }
+    std::sort(angles.begin(), angles.end());
+    auto kind = (total > 0.0f) ? unit() * total : 0.0f;
+    auto concave = (kind >= spec.convex && kind < spec.convex + spec.concave);
+    if (kind >= spec.convex + spec.concave && total > 0.0f) {
+      for (auto k = n - 1; k > 0; --k) {
+        std::swap(angles[k], angles[engine() % (k + 1)]);
+      }
+    }
+    Point center{unit() * width, unit() * height};
+    auto heading = 2 * M_PI * unit();
+    auto spin = (unit() - 0.5f) * 2 * spec.motion / radius;
+    auto rotation = 0.0f;
+    for (int k = 0; k < std::max(spec.keyframes, 1); ++k) {
+      Frame f;
+      f.number = 1 + k * KEYFRAME_STEP;
+      for (int j = 0; j < n; ++j) {
+        auto d = (concave && j % 2) ? 0.4f * radius : radius;
+        auto a = angles[j] + rotation;
+        f.vertices.emplace_back(Point{std::round(center.x + d * std::cos(a)),
+                                      std::round(center.y + d * std::sin(a))});
+      }
+      obj->keyframes.push_back(f);
+      center += Point{static_cast<float>(spec.motion * std::cos(heading)),
+                      static_cast<float>(spec.motion * std::sin(heading))};
+      rotation += spin;
+    }
+    polygons.push_back(obj);
+  }
+}
+
+// Remove the file of a frame before it's written, it may be a hard link to
+// another frame of an earlier run that must keep its pixels.
+static void unlink_frame(const std::string& filename)
+{
+  std::remove(filename.c_str());
+}
+
+// Make the file <copy> the same as <original>, a hard link if possible.
+static void duplicate(const std::string& original, const std::string& copy)
+{
+  unlink_frame(copy);
+  if (0 == link(original.c_str(), copy.c_str())) {
+    return;
+  }
+  std::ifstream src(original, std::ios::binary);
+  std::ofstream dst(copy, std::ios::binary);
+  dst << src.rdbuf();
+}
+
+bool Scene::renderToFile(const std::vector<std::string>& args)
 {
   std::string infile;
   std::string outfile;
   std::string basename{"basename"};
+  std::string aa_filter;
   std::istringstream iss;
   auto num_aa_samples = 1;
   auto num_mb_samples = 1;
   auto aa_enabled = false;
   auto mb_enabled = false;
+  auto print_stats = false;
+  auto trace_level = Trace::OFF;
+  std::string trace_file;
+  auto profiling = false;
+  auto tuning = false;
+  auto budget = 0.0;
+  auto canvas_width = width;
+  auto canvas_height = height;
+  auto band = 0;
+  // the crop (x, y, w, h) of the canvas, and the label of a full render to
+  // put it into.
+  int crop[4] = {0, 0, 0, 0};
+  std::string into;
+  auto target_psnr = 0.0;
+  auto target_ssim = 0.0;
+  std::string heatmap_file;
   auto first_frame = 0;
   auto final_frame = 0;
 
   if (args.size() < 4 || args[0] == "-help") {
-    std::cout << "Usage: rasterizer [-a<#samples>] [-m<#samples>]"
-              << " <first frame> <last frame> <infile> <outfile>\n";
-    return;
+    std::cout << "Usage: rasterizer [-a<#samples>] [-m<#samples>] [-f<filter>]"
+              << " [--stats] [--trace[-all]=<file>] [--profile]"
+              << " [--heatmap=<file>] [--tune=<dB>[,<ssim>]]"
+              << " [--time-budget-ms=<ms>] [--size=<width>x<height>]"
+              << " [--band=<lines>] [--crop=<x>,<y>,<width>x<height>]"
+              << " [--into=<label>] [--isa=<generic|sse4.2|avx2|avx512>]"
+              << " <first frame> <last frame> <infile>"
+              << " <outfile>\n";
+    return !args.empty() && args[0] == "-help";
   }
 
   auto arg = args.crbegin();
@@ -149,18 +261,92 @@ void Scene::renderToFile(const std::vector<std::string>& args)
   if (first_frame < 1 || final_frame < 1) {
     std::cerr << "Incorrect arguments: first or last frame < 1.\n"
               << "Type 'rasterizer -help' for more info\n";
-    return;
+    return false;
   }
-  if (arg != args.crend()) {
-    std::string s = *arg++;
-    if (s.substr(0, 2) == "-m") {
+  // everything in front of the frame range is an option.
+  for (auto it = args.cbegin(), E = args.cend() - 4; it != E; ++it) {
+    auto& s = *it;
+    if (s == "--stats") {
+      print_stats = true;
+    } else if (s.substr(0, 7) == "--tune=") {
+      iss.clear();
+      iss.str(s.substr(7));
+      char comma;
+      tuning = (iss >> target_psnr) && target_psnr > 0 &&
+               (iss.eof() || ((iss >> comma >> target_ssim) && comma == ','));
+      if (!tuning) {
+        std::cerr << "Incorrect arguments: " << s << ".\n"
+                  << "Type 'rasterizer -help' for more info\n";
+        return false;
+      }
+    } else if (s.substr(0, 7) == "--size=") {
+      iss.clear();
+      iss.str(s.substr(7));
+      char x;
+      if (!(iss >> canvas_width >> x >> canvas_height) || x != 'x' ||
+          canvas_width < 1 || canvas_height < 1) {
+        std::cerr << "Incorrect arguments: " << s << ".\n"
+                  << "Type 'rasterizer -help' for more info\n";
+        return false;
+      }
+    } else if (s.substr(0, 7) == "--band=") {
+      iss.clear();
+      iss.str(s.substr(7));
+      if (!(iss >> band) || band < 1) {
+        std::cerr << "Incorrect arguments: band height < 1.\n"
+                  << "Type 'rasterizer -help' for more info\n";
+        return false;
+      }
+    } else if (s.substr(0, 7) == "--crop=") {
+      iss.clear();
+      iss.str(s.substr(7));
+      char comma, x;
+      if (!(iss >> crop[0] >> comma >> crop[1] >> comma >> crop[2] >> x
+                >> crop[3]) || x != 'x' || crop[0] < 0 || crop[1] < 0 ||
+          crop[2] < 1 || crop[3] < 1) {
+        std::cerr << "Incorrect arguments: " << s << ".\n"
+                  << "Type 'rasterizer -help' for more info\n";
+        return false;
+      }
+    } else if (s.substr(0, 7) == "--into=" && s.size() > 7) {
+      into = s.substr(7);
+    } else if (s.substr(0, 6) == "--isa=") {
+      auto isa = Kernels::parse(s.substr(6));
+      if (isa == Kernels::ISA_COUNT) {
+        std::cerr << "Incorrect arguments: " << s << ".\n"
+                  << "Type 'rasterizer -help' for more info\n";
+        return false;
+      }
+      if (!Kernels::select(isa)) {
+        std::cerr << "The CPU doesn't support " << Kernels::name(isa) << "\n";
+        return false;
+      }
+    } else if (s.substr(0, 17) == "--time-budget-ms=") {
+      iss.clear();
+      iss.str(s.substr(17));
+      if (!(iss >> budget) || budget <= 0) {
+        std::cerr << "Incorrect arguments: time budget <= 0 ms.\n"
+                  << "Type 'rasterizer -help' for more info\n";
+        return false;
+      }
+    } else if (s == "--profile") {
+      profiling = true;
+    } else if (s.substr(0, 10) == "--heatmap=" && s.size() > 10) {
+      heatmap_file = s.substr(10);
+    } else if (s.substr(0, 8) == "--trace=" && s.size() > 8) {
+      trace_level = Trace::COARSE;
+      trace_file = s.substr(8);
+    } else if (s.substr(0, 12) == "--trace-all=" && s.size() > 12) {
+      trace_level = Trace::DETAIL;
+      trace_file = s.substr(12);
+    } else if (s.substr(0, 2) == "-m") {
       iss.clear();
       iss.str(s.substr(2));
       iss >> num_mb_samples;
       if (num_mb_samples < 1) {
         std::cerr << "Incorrect arguments: number of motion blur samples < 1.\n"
                   << "Type 'rasterizer -help' for more info\n";
-        return;
+        return false;
       } else {
         mb_enabled = true;
       }
@@ -171,39 +357,356 @@ void Scene::renderToFile(const std::vector<std::string>& args)
       if (num_aa_samples < 1) {
         std::cerr << "Incorrect arguments: number of antialiasing samples < 1.\n"
                   << "Type 'rasterizer -help' for more info\n";
-        return;
+        return false;
       } else {
         aa_enabled = true;
       }
+    } else if (s.substr(0, 2) == "-f") {
+      aa_filter = s.substr(2);
+    } else {
+      std::cerr << "Incorrect arguments: unknown option " << s << ".\n"
+                << "Type 'rasterizer -help' for more info\n";
+      return false;
     }
   }
-  if (arg != args.crend()) {
-    std::string s = *arg++;
-    if (s.substr(0, 2) == "-a") {
-      iss.clear();
-      iss.str(s.substr(2));
-      iss >> num_aa_samples;
-      if (num_aa_samples < 1) {
-        std::cerr << "Incorrect arguments: number of antialiasing samples < 1.\n"
-                  << "Type 'rasterizer -help' for more info\n";
-        return;
-      } else {
-        aa_enabled = true;
-      }
+  if (crop[2] && (crop[0] + crop[2] > canvas_width ||
+                  crop[1] + crop[3] > canvas_height || band)) {
+    std::cerr << "Incorrect arguments: the crop is not inside the canvas"
+              << " or is banded.\n"
+              << "Type 'rasterizer -help' for more info\n";
+    return false;
+  }
+  if (tuning && band) {
+    std::cerr << "Incorrect arguments: --tune can't be banded.\n"
+              << "Type 'rasterizer -help' for more info\n";
+    return false;
+  }
+  if (!into.empty() && !crop[2]) {
+    std::cerr << "Incorrect arguments: --into needs a --crop.\n"
+              << "Type 'rasterizer -help' for more info\n";
+    return false;
+  }
+  if (trace_level != Trace::OFF) {
+    if (!Trace::compiled()) {
+      std::cerr << "Tracing is not compiled in, configure with"
+                << " -Denable_tracing=ON to record " << trace_file << "\n";
+    }
+    Trace::start(trace_level);
+  }
+  if (!load(infile)) {
+    return false;
+  }
+  // the canvas of the whole frame is never allocated in bands.
+  if (!band && (canvas_width != width || canvas_height != height)) {
+    resize(canvas_width, canvas_height);
+  }
+  // a crop is rendered with the pixels around it, for adaptive AA to find the
+  // same edges as on the whole canvas.
+  auto left = std::max(crop[0] - 1, 0);
+  auto top = std::max(crop[1] - 1, 0);
+  if (crop[2]) {
+    rasterizer.resize(std::min(crop[0] + crop[2] + 1, canvas_width) - left,
+                      std::min(crop[1] + crop[3] + 1, canvas_height) - top);
+    rasterizer.setOrigin(left, top);
+  }
+  // the sampling is tuned on the canvas or the crop rendered.
+  if (tuning) {
+    auto best = tune(first_frame, final_frame, target_psnr, target_ssim,
+                     &std::cout);
+    if (!best.found) {
+      std::cout << "No sampling reaches " << target_psnr << " dB and SSIM "
+                << target_ssim << ", the reference is "
+                << best.options() << "\n";
+      return false;
     }
+    std::cout << "Use " << best.options() << ": " << best.psnr << " dB, SSIM "
+              << best.ssim << ", " << best.time * 1e3 << " ms per frame\n";
+    return true;
   }
-  load(infile);
   std::ofstream listfile(outfile + ".list");
   assert(listfile);
 
+  // the polygons that stay still during the whole sequence are rendered once.
+  Layers layers;
+  if (first_frame < final_frame && !band) {
+    rasterizer.cache(polygons, first_frame, final_frame,
+                     aa_enabled, num_aa_samples, aa_filter, layers);
+  }
+
+  RenderSettings settings(aa_enabled, num_aa_samples,
+                          mb_enabled, num_mb_samples, aa_filter);
+  settings.budget = budget / 1000;
+  Profile profile(!heatmap_file.empty());
+  auto* pprofile = (profiling || profile.heatmap) ? &profile : nullptr;
+
+  // a frame that looks the same as the previous one is not rendered again,
+  // unless it's put into a frame of its own.
+  std::string previous;
+  uint64_t signature = 0;
   for (auto frame = first_frame; frame <= final_frame; ++frame) {
-    rasterizer.run(polygons, frame, aa_enabled, num_aa_samples,
-                   mb_enabled, num_mb_samples, "");
+    TRACE_SCOPE("frame");
     std::ostringstream oss;
     oss << outfile << "." << frame << ".ppm";
-    rasterizer.save(oss.str());
+    auto current = rasterizer.signature(polygons, frame,
+                                        aa_enabled, num_aa_samples,
+                                        mb_enabled, num_mb_samples, aa_filter);
+    RenderStats stats;
+    stats.frame = frame;
+    auto start = std::chrono::steady_clock::now();
+    auto copied = into.empty() && !previous.empty() && current == signature;
+    if (copied) {
+      duplicate(previous, oss.str());
+    } else if (band) {
+      // the bands are written as soon as they are done.
+      unlink_frame(oss.str());
+      stats = renderBands(frame, settings, canvas_width, canvas_height, band,
+                          oss.str(), pprofile);
+      previous = oss.str();
+      signature = current;
+    } else {
+      stats = rasterizer.run(polygons, frame, settings, &layers, pprofile);
+      start = std::chrono::steady_clock::now();
+      if (crop[2]) {
+        auto part = Image(rasterizer).crop(crop[0] - left, crop[1] - top,
+                                           crop[2], crop[3]);
+        Image full;
+        if (!into.empty()) {
+          auto file = into + "." + std::to_string(frame) + ".ppm";
+          if (!full.load(file) || full.width != canvas_width ||
+              full.height != canvas_height) {
+            std::cerr << "Can't read the " << canvas_width << "x"
+                      << canvas_height << " image " << file << "\n";
+            return false;
+          }
+          full.paste(part, crop[0], crop[1]);
+        }
+        unlink_frame(oss.str());
+        (into.empty() ? part : full).save(oss.str());
+      } else {
+        unlink_frame(oss.str());
+        rasterizer.save(oss.str());
+      }
+      previous = oss.str();
+      signature = current;
+    }
+    if (copied || !band) {
+      stats.write = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    }
+    if (print_stats) {
+      std::cout << stats << std::endl;
+    }
+    if (budget > 0 && stats.planned) {
+      std::cout << "Frame " << frame << ": " << stats.passes << " of "
+                << stats.planned << " samples\n";
+    }
     listfile << basename << "." << frame << ".ppm" << "\n";
   }
+  if (profiling) {
+    profile.report(std::cout);
+  }
+  if (profile.heatmap && !profile.saveHeatmap(heatmap_file)) {
+    std::cerr << "Can't write the heatmap to " << heatmap_file << "\n";
+    return false;
+  }
+  if (trace_level != Trace::OFF && !Trace::stop(trace_file)) {
+    std::cerr << "Can't write the trace to " << trace_file << "\n";
+    return false;
+  }
+  return true;
+}
+
+RenderStats Scene::renderBands(int frame, const RenderSettings& settings,
+                               int w, int h, int band,
+                               const std::string& filename, Profile* profile)
+{
+  TRACE_SCOPE("Scene::renderBands");
+  RenderStats total;
+  total.frame = frame;
+  std::ofstream output(filename, std::ios::binary);
+  assert(output);
+  output << "P6\n# Comment Line\n" << w << " " << h << "\n255\n";
+  // the time budget is for the whole frame, every band gets its share of
+  // the time left.
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(settings.budget));
+  RenderSettings strip_settings(settings);
+  // the heatmap covers the whole canvas, not just a band.
+  if (profile && profile->heatmap &&
+      (profile->left || profile->top || profile->width != w ||
+       profile->height != h)) {
+    profile->left = 0;
+    profile->top = 0;
+    profile->width = w;
+    profile->height = h;
+    profile->writes.assign(size_t(w) * h, 0);
+  }
+  // every band is rendered with the lines next to it, for adaptive AA to
+  // find the same edges across the bands as on the whole canvas.
+  Rasterizer strip(w, 0);
+  for (int y = 0; y < h; y += band) {
+    auto y0 = std::max(y - 1, 0);
+    auto y1 = std::min(y + band + 1, h);
+    if (strip.getHeight() != y1 - y0) {
+      strip.resize(w, y1 - y0);
+    }
+    strip.setOrigin(0, y0);
+    if (settings.budget > 0) {
+      std::chrono::duration<double> left =
+        deadline - std::chrono::steady_clock::now();
+      auto bands = (h - y + band - 1) / band;
+      // a band out of time still takes its first pass.
+      strip_settings.budget = std::max(left.count() / bands, 1e-9);
+    }
+    auto stats = strip.run(polygons, frame, strip_settings, nullptr, profile);
+    auto start = std::chrono::steady_clock::now();
+    strip.write(output, y - y0, std::min(band, h - y));
+    total.write += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    total.interpolate += stats.interpolate;
+    total.setup += stats.setup;
+    total.scan += stats.scan;
+    total.accumulate += stats.accumulate;
+    total.resolve += stats.resolve;
+    total.polygons += stats.polygons;
+    total.edges += stats.edges;
+    total.active = std::max(total.active, stats.active);
+    total.spans += stats.spans;
+    total.pixels += stats.pixels;
+    total.passes = (y == 0) ? stats.passes
+                            : std::min(total.passes, stats.passes);
+    total.planned = stats.planned;
+    total.memory = std::max(total.memory,
+                            stats.memory + strip.getFootprint());
+    total.scratch = std::max(total.scratch, stats.scratch);
+    total.allocations += stats.allocations;
+    total.allocated += stats.allocated;
+    total.peak = std::max(total.peak, stats.peak);
+  }
+  return total;
+}
+
+std::string Tuning::options() const
+{
+  std::ostringstream oss;
+  oss << "-a" << num_aa_samples;
+  if (num_mb_samples > 1) {
+    oss << " -m" << num_mb_samples;
+  }
+  oss << " -f" << filter;
+  return oss.str();
+}
+
+/**
+   The sampling is tried on the first, the middle and the last frame.  The
+   quality grows with the AA samples, so for every filter and number of MB
+   samples the AA samples go up until the quality is reached.  With more
+   MB samples only fewer AA samples than found before can be faster, and no
+   more samples are tried once they take longer than the best sampling so
+   far.  The adaptive version of a sampling that is good enough is tried
+   too.
+ */
+Tuning Scene::tune(int first, int last, double psnr, double ssim,
+                   std::ostream* log)
+{
+  static const int AA[] = {1, 4, 9, 16, 25, 36, 49, 64};
+  static const int MB[] = {1, 2, 4, 8, 16};
+  static const char* FILTERS[] = {"grid", "random", "grid,bartlett",
+                                  "random,bartlett"};
+  std::vector<int> frames{first, (first + last) / 2, last};
+  frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+
+  std::vector<Image> references;
+  RenderSettings reference(true, 64, true, 32, "random");
+  for (auto frame : frames) {
+    rasterizer.run(polygons, frame, reference);
+    references.emplace_back(rasterizer);
+  }
+
+  Tuning best;
+  best.num_aa_samples = 64;
+  best.num_mb_samples = 32;
+  best.filter = "random";
+  // every frame is timed as the median of at least TIMINGS renders taking
+  // at least TIMING seconds together, and the times closer than TIE are the
+  // same: the fewer samples or the sampling tried first wins, so the noise
+  // of the timing doesn't decide.
+  static const size_t TIMINGS = 3;
+  static const double TIMING = 0.01;
+  static const double TIE = 0.25;
+  auto faster = [](const Tuning& a, const Tuning& b) {
+    if (std::abs(a.time - b.time) > TIE * std::max(a.time, b.time)) {
+      return a.time < b.time;
+    }
+    return a.num_aa_samples * a.num_mb_samples <
+           b.num_aa_samples * b.num_mb_samples;
+  };
+  // render the frames with the sampling of <tuning> and measure it.
+  auto measure = [&](Tuning& tuning) {
+    RenderSettings settings(true, tuning.num_aa_samples,
+                            true, tuning.num_mb_samples, tuning.filter);
+    tuning.psnr = std::numeric_limits<double>::infinity();
+    tuning.ssim = 1.0;
+    tuning.time = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+      std::vector<double> times;
+      auto total = 0.0;
+      while (times.size() < TIMINGS || total < TIMING) {
+        auto start = std::chrono::steady_clock::now();
+        rasterizer.run(polygons, frames[i], settings);
+        times.push_back(std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count());
+        total += times.back();
+      }
+      std::nth_element(times.begin(), times.begin() + times.size() / 2,
+                       times.end());
+      tuning.time += times[times.size() / 2];
+      Image image(rasterizer);
+      tuning.psnr = std::min(tuning.psnr, image.psnr(references[i]));
+      tuning.ssim = std::min(tuning.ssim, image.ssim(references[i]));
+    }
+    tuning.time /= frames.size();
+    tuning.found = tuning.psnr >= psnr && tuning.ssim >= ssim;
+    if (log) {
+      *log << tuning.options() << ": " << tuning.psnr << " dB, SSIM "
+           << tuning.ssim << ", " << tuning.time * 1e3 << " ms"
+           << (tuning.found ? "" : ", not enough") << "\n";
+    }
+    if (tuning.found && (!best.found || faster(tuning, best))) {
+      best = tuning;
+    }
+    return tuning.found;
+  };
+
+  for (auto* filter : FILTERS) {
+    // the AA samples needed with fewer MB samples.
+    auto enough = std::end(AA);
+    for (auto mb = std::begin(MB); mb != std::end(MB); ++mb) {
+      auto aa = std::begin(AA);
+      for (; aa != enough; ++aa) {
+        Tuning tuning;
+        tuning.num_aa_samples = *aa;
+        tuning.num_mb_samples = *mb;
+        tuning.filter = filter;
+        if (measure(tuning)) {
+          enough = aa;
+          tuning.filter += ",adaptive";
+          if (*aa > 1) {
+            measure(tuning);
+          }
+          break;
+        }
+        if (best.found && faster(best, tuning)) {
+          break;
+        }
+      }
+      if (aa == std::begin(AA)) {
+        break;
+      }
+    }
+  }
+  return best;
 }
 
 void Scene::setRotationOrScalingCenter(const long x, const long y)
@@ -13,9 +13,59 @@
 #include "rasterizer.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
+/**
+   \brief StressSpec describes a synthetic scene made by Scene::generate.
+*/
+struct StressSpec {
+  int polygons;
+  int vertices;
+  int keyframes;
+  // the shares of convex, concave and self-intersecting polygons.
+  float convex;
+  float concave;
+  float crossing;
+  // how many polygons cover a pixel of the canvas on average.
+  float depth;
+  // how many pixels a polygon moves between two keyframes.
+  float motion;
+  uint32_t seed;
+
+  StressSpec()
+    : polygons(100), vertices(8), keyframes(2)
+    , convex(1.0f), concave(0.0f), crossing(0.0f)
+    , depth(2.0f), motion(10.0f), seed(1)
+  {}
+};
+
+/**
+   \brief Tuning is the sampling found by Scene::tune, the quality of the
+          worst of the frames it was tried on compared with the reference
+          sampling, and the mean time in seconds to render a frame with it.
+*/
+struct Tuning {
+  int num_aa_samples;
+  int num_mb_samples;
+  std::string filter;
+  double psnr;
+  double ssim;
+  double time;
+  // if the sampling meets the quality asked for.
+  bool found;
+
+  Tuning()
+    : num_aa_samples(1), num_mb_samples(1), psnr(0), ssim(0), time(0)
+    , found(false)
+  {}
+
+  // the options of the batch renderer for the sampling.
+  std::string options() const;
+};
+
 /**
    \class manages the objects to be rendered.
  */
@@ -141,8 +191,43 @@ public:
   }
 
   bool load(const std::string& filename);
+  /**
+     \brief replaces the polygons with random ones as the <spec> says.  The
+            same <spec> always makes the same scene.
+  */
+  void generate(const StressSpec& spec);
   void save(const std::string& filename) const;
-  void renderToFile(const std::vector<std::string>& args);
+  /**
+     \brief renders frames to files in batch mode, see README.org for the
+            <args>.
+     \return false if the arguments are wrong or the scene can't be loaded.
+  */
+  bool renderToFile(const std::vector<std::string>& args);
+  /**
+     \brief finds the fastest sampling of the frames [first, last] whose PSNR
+            and SSIM against a rendering with 64 AA and 32 MB samples are at
+            least <psnr> dB and <ssim>.  Of the samplings within a quarter
+            of the same time the one with fewer samples is taken, for the
+            result not to depend on the noise of the timing.  The samplings
+            tried are written to the <log> if there is one.
+     \return the reference sampling, not found, if no cheaper sampling is
+             good enough.
+  */
+  Tuning tune(int first, int last, double psnr, double ssim,
+              std::ostream* log = nullptr);
+  /**
+     \brief renders the <frame> on a canvas of <w> x <h> pixels into the PPM
+            file <filename> in bands of <band> lines.  Every band is written
+            as soon as it's done, so only a band is held in memory.  The
+            time budget of the <settings> is shared by the bands, and the
+            work of every band is added to the <profile> if there is one.
+     \return the work of all bands, the memory of the largest one and the
+             passes of the band that took the fewest.
+  */
+  RenderStats renderBands(int frame, const RenderSettings& settings,
+                          int w, int h, int band,
+                          const std::string& filename,
+                          Profile* profile = nullptr);
 
   void drag(const int frame, const long x, const long y);
   void draw(const long x, const long y);
@@ -0,0 +1,89 @@
+/**
+   \file trace.cpp
+ */
+
+#include "trace.h"
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<int> Trace::current(Trace::OFF);
+
+struct TraceEvent {
+  const char* name;
+  Trace::Clock::time_point begin;
+  Trace::Clock::time_point end;
+};
+
+// every thread appends to its own buffer without locking.
+struct TraceBuffer {
+  int tid;
+  std::vector<TraceEvent> events;
+};
+
+static std::mutex lock;
+static std::vector<std::shared_ptr<TraceBuffer>> buffers;
+static Trace::Clock::time_point epoch;
+
+// the buffer of the calling thread, registered on the first event.
+static TraceBuffer& local()
+{
+  thread_local std::shared_ptr<TraceBuffer> buffer;
+  if (!buffer) {
+    buffer = std::make_shared<TraceBuffer>();
+    std::lock_guard<std::mutex> guard(lock);
+    buffer->tid = buffers.size() + 1;
+    buffers.push_back(buffer);
+  }
+  return *buffer;
+}
+
+// the trace-event timestamps are in microseconds.
+static double microseconds(Trace::Clock::duration d)
+{
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void Trace::start(LEVEL level)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto& b : buffers) {
+      b->events.clear();
+    }
+    epoch = Clock::now();
+  }
+  current.store(level);
+}
+
+void Trace::add(const char* name, Clock::time_point begin,
+                Clock::time_point end)
+{
+  local().events.push_back(TraceEvent{name, begin, end});
+}
+
+bool Trace::stop(const std::string& filename)
+{
+  current.store(OFF);
+  std::ofstream ofs(filename);
+  if (!ofs) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  ofs << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+  auto comma = "";
+  for (auto& b : buffers) {
+    for (auto& e : b->events) {
+      ofs << comma << "\n{\"name\": \"" << e.name << "\", \"ph\": \"X\""
+          << ", \"ts\": " << microseconds(e.begin - epoch)
+          << ", \"dur\": " << microseconds(e.end - e.begin)
+          << ", \"pid\": 1, \"tid\": " << b->tid << "}";
+      comma = ",";
+    }
+    b->events.clear();
+  }
+  ofs << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  return bool(ofs);
+}
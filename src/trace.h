@@ -0,0 +1,89 @@
+/**
+   \file trace.h
+
+   Scopes of the rendering recorded as Chrome trace events, that can be
+   viewed in chrome://tracing or https://ui.perfetto.dev.
+*/
+
+#ifndef trace_h
+#define trace_h
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/**
+   \class Trace collects the scopes of all threads while it's started and
+          writes them to a trace-event JSON file when it's stopped.  The
+          scopes are compiled in only if RASTERIZER_TRACE is defined.
+*/
+class Trace {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // COARSE records frames, samples and files, DETAIL also every polygon.
+  enum LEVEL { OFF, COARSE, DETAIL };
+
+  static void start(LEVEL level);
+  /**
+     \brief stops recording and writes the events to the <filename>.  The
+            threads that render must be done before the trace is stopped.
+     \return false if the file can't be written.
+  */
+  static bool stop(const std::string& filename);
+
+  static bool on(LEVEL level) {
+    return level <= current.load(std::memory_order_relaxed);
+  }
+
+  static void add(const char* name, Clock::time_point begin,
+                  Clock::time_point end);
+
+  static bool compiled() {
+#ifdef RASTERIZER_TRACE
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  class Scope {
+    const char* name;
+    bool active;
+    Clock::time_point begin;
+
+  public:
+    Scope(LEVEL level, const char* name) : name(name), active(on(level)) {
+      if (active) {
+        begin = Clock::now();
+      }
+    }
+
+    ~Scope() {
+      if (active) {
+        add(name, begin, Clock::now());
+      }
+    }
+  };
+
+private:
+  static std::atomic<int> current;
+};
+
+#ifdef RASTERIZER_TRACE
+#define TRACE_JOIN(a, b) a##b
+#define TRACE_NAME(a, b) TRACE_JOIN(a, b)
+#define TRACE_SCOPE(name) \
+  Trace::Scope TRACE_NAME(trace_scope_, __LINE__)(Trace::COARSE, name)
+#define TRACE_DETAIL(name) \
+  Trace::Scope TRACE_NAME(trace_scope_, __LINE__)(Trace::DETAIL, name)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_DETAIL(name)
+#endif
+
+#endif /* trace_h */
+
+// Local Variables:
+// mode: c++
+// End:
@@ -39,7 +39,10 @@ private:
     if (gc) {
       auto w = rasterizer.getWidth();
       auto h = rasterizer.getHeight();
-      wxBitmap bmp(wxImage(w, h, rasterizer.getPixelsAsRGB()));
+      // the image shows the packed pixels of the rasterizer without a copy,
+      // they are packed again only after the frame changed.
+      auto* rgb = const_cast<unsigned char*>(rasterizer.getRGB());
+      wxBitmap bmp(wxImage(w, h, rgb, true));
       gc->DrawBitmap(bmp, 0, 0, w, h);
       delete gc;
     }
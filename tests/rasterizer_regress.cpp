@@ -0,0 +1,300 @@
+/**
+   \file rasterizer_regress.cpp compares the renderings of the example scenes
+   with the golden images in tests/golden/ rendered by this rasterizer, and
+   the rendering times with a recorded baseline.  The reference images and
+   animations in examples/ that came with the scenes are only checked
+   loosely.
+ */
+
+#include "image.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+   \brief Reference is a reference image or animation of an example scene
+          that came with it, the sampling it was rendered with and the least
+          PSNR of the rendering to it.
+*/
+struct Reference {
+  const char* scene;
+  const char* file;
+  int aa;
+  int mb;
+  const char* filter;
+  // the animations show the canvas moved by (x, y) in a larger window.
+  float x;
+  float y;
+  // the least PSNR in dB, averaged over the frames.
+  double psnr;
+};
+
+// the references were rendered by another rasterizer, and the animations are
+// quantized to 256 colors and their motion blur was sampled differently, so
+// they only catch a rendering that is entirely wrong.
+static const Reference REFERENCES[] = {
+  {"sample2", "sample2.ppm", 25, 1, "grid", 0, 0, 40.0},
+  {"sample3", "sample3.ppm", 4, 1, "grid", 0, 0, 40.0},
+  {"sample1", "sample1.fli", 16, 8, "", 20, 40, 20.0},
+  {"sample4", "sample4.fli", 1, 16, "", 20, 40, 20.0},
+  {"sample5", "sample5.fli", 16, 8, "", 20, 40, 20.0},
+  {"sampleA", "sampleA.flc", 16, 1, "", 20, 40, 20.0},
+  {"sampleC", "sampleC.flc", 16, 8, "", 20, 40, 20.0},
+};
+
+// the golden images are the middle frames rendered with 16 AA and 4 MB
+// samples and the default seed.  A pixel may change by 2 of its 64 samples.
+static const double GOLDEN_PSNR = 60.0;
+static const int GOLDEN_ERROR = 8;
+
+static std::string example(const std::string& name)
+{
+  return std::string(EXAMPLES_DIR "/") + name;
+}
+
+static std::string golden(const std::string& name)
+{
+  return std::string(GOLDEN_DIR "/") + name + ".ppm";
+}
+
+// the names of the example scenes without the .obs suffix.
+static std::vector<std::string> list_examples()
+{
+  std::vector<std::string> names;
+  auto* dir = opendir(EXAMPLES_DIR);
+  if (!dir) {
+    return names;
+  }
+  while (auto* entry = readdir(dir)) {
+    std::string name(entry->d_name);
+    if (name.size() > 4 && name.substr(name.size() - 4) == ".obs") {
+      names.push_back(name.substr(0, name.size() - 4));
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+/**
+   \brief render the frames of the <reference> and compare them with it.
+   \return false if a file can't be read or the rendering is too far off.
+ */
+static bool compare(const Reference& reference)
+{
+  std::vector<Image> frames;
+  std::string file(reference.file);
+  if (file.substr(file.size() - 4) == ".ppm") {
+    frames.resize(1);
+    if (!frames[0].load(example(file))) {
+      frames.clear();
+    }
+  } else {
+    loadFlic(example(file), frames);
+  }
+  Scene scene(frames.empty() ? 0 : frames[0].width,
+              frames.empty() ? 0 : frames[0].height);
+  if (frames.empty() || !scene.load(example(reference.scene) + ".obs")) {
+    std::cout << reference.file << ": can't be read\n";
+    return false;
+  }
+  for (auto& p : scene.getPolygons()) {
+    for (auto& k : p->keyframes) {
+      for (auto& v : k.vertices) {
+        v += Point{reference.x, reference.y};
+      }
+    }
+  }
+  RenderSettings settings(reference.aa > 1, reference.aa,
+                          reference.mb > 1, reference.mb, reference.filter);
+  auto psnr = 0.0;
+  for (size_t f = 0; f < frames.size(); ++f) {
+    scene.getRasterizer().run(scene.getPolygons(), f + 1, settings);
+    psnr += std::min(Image(scene.getRasterizer()).psnr(frames[f]), 99.0);
+  }
+  psnr /= frames.size();
+  auto ok = psnr >= reference.psnr;
+  std::cout << std::setw(12) << reference.file << std::fixed
+            << std::setprecision(2) << "  PSNR " << std::setw(6) << psnr
+            << " dB (>= " << reference.psnr << ")"
+            << (ok ? "" : "  FAILED") << "\n";
+  return ok;
+}
+
+// the frame in the middle of the animation, where the polygons move.
+static int middle_frame(const Scene& scene)
+{
+  auto last = 1;
+  for (auto& p : scene.getPolygons()) {
+    last = std::max(last, p->keyframes.back().number);
+  }
+  return (last + 1) / 2;
+}
+
+/**
+   \brief render the middle frame of every example and compare it with its
+          golden image, or write the golden images if <update>.
+   \return false if a golden image can't be read or written, or the
+           rendering is too far off.
+ */
+static bool compare_golden(bool update)
+{
+  auto passed = true;
+  RenderSettings settings(true, 16, true, 4);
+  for (auto& name : list_examples()) {
+    Scene scene;
+    if (!scene.load(example(name) + ".obs")) {
+      std::cout << name << ": can't be read\n";
+      passed = false;
+      continue;
+    }
+    scene.getRasterizer().run(scene.getPolygons(), middle_frame(scene),
+                              settings);
+    Image image(scene.getRasterizer());
+    if (update) {
+      if (!image.save(golden(name))) {
+        std::cout << golden(name) << ": can't be written\n";
+        passed = false;
+      }
+      continue;
+    }
+    Image expected;
+    if (!expected.load(golden(name)) || expected.width != image.width ||
+        expected.height != image.height) {
+      std::cout << golden(name) << ": can't be read\n";
+      passed = false;
+      continue;
+    }
+    auto psnr = std::min(image.psnr(expected), 99.0);
+    auto error = image.maxError(expected);
+    auto ok = psnr >= GOLDEN_PSNR && error <= GOLDEN_ERROR;
+    std::cout << std::setw(12) << name << std::fixed << std::setprecision(2)
+              << "  PSNR " << std::setw(6) << psnr << " dB  max error "
+              << std::setw(3) << error << (ok ? "" : "  FAILED") << "\n";
+    passed = passed && ok;
+  }
+  return passed;
+}
+
+// the fastest of <repeat> renders in ms of the middle frame of every example
+// with 16 AA and 4 MB samples.
+static std::map<std::string, double> measure(int repeat)
+{
+  std::map<std::string, double> times;
+  RenderSettings settings(true, 16, true, 4);
+  for (auto& name : list_examples()) {
+    Scene scene;
+    if (!scene.load(example(name) + ".obs")) {
+      continue;
+    }
+    auto frame = middle_frame(scene);
+    auto best = 0.0;
+    for (int i = 0; i < repeat; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      scene.getRasterizer().run(scene.getPolygons(), frame, settings);
+      std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now() - start;
+      best = (i == 0) ? time.count() : std::min(best, time.count());
+    }
+    times[name] = best;
+  }
+  return times;
+}
+
+static void usage()
+{
+  std::cout << "Usage: rasterizer_regress [--update-golden]"
+            << " [--record=<file>] [--baseline=<file>]"
+            << " [--tolerance=<percent>] [--repeat=<n>]\n";
+}
+
+int main(int argc, char** argv)
+{
+  std::string record;
+  std::string baseline;
+  auto tolerance = 10.0;
+  auto repeat = 5;
+  auto update = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string s(argv[i]);
+    std::istringstream iss(s.substr(s.find('=') + 1));
+    auto ok = true;
+    if (s.substr(0, 9) == "--record=") {
+      record = iss.str();
+    } else if (s.substr(0, 11) == "--baseline=") {
+      baseline = iss.str();
+    } else if (s.substr(0, 12) == "--tolerance=") {
+      ok = (iss >> tolerance) && tolerance >= 0;
+    } else if (s.substr(0, 9) == "--repeat=") {
+      ok = (iss >> repeat) && repeat > 0;
+    } else if (s == "--update-golden") {
+      update = true;
+    } else if (s == "-help") {
+      usage();
+      return 0;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      std::cerr << "Incorrect arguments: " << s << ".\n"
+                << "Type 'rasterizer_regress -help' for more info\n";
+      return 1;
+    }
+  }
+
+  auto passed = compare_golden(update);
+  if (update) {
+    return passed ? 0 : 1;
+  }
+  for (auto& reference : REFERENCES) {
+    passed = compare(reference) && passed;
+  }
+  if (record.empty() && baseline.empty()) {
+    return passed ? 0 : 1;
+  }
+
+  auto times = measure(repeat);
+  if (!record.empty()) {
+    std::ofstream output(record);
+    for (auto& t : times) {
+      output << t.first << " " << t.second << "\n";
+    }
+    if (!output) {
+      std::cerr << "Can't write the baseline to " << record << "\n";
+      return 1;
+    }
+  }
+  if (!baseline.empty()) {
+    std::ifstream input(baseline);
+    if (!input) {
+      std::cerr << "Can't read the baseline " << baseline << "\n";
+      return 1;
+    }
+    std::string name;
+    double before;
+    while (input >> name >> before) {
+      auto it = times.find(name);
+      if (it == times.end()) {
+        continue;
+      }
+      auto change = 100 * (it->second - before) / before;
+      auto ok = change <= tolerance;
+      std::cout << std::setw(12) << name << std::fixed << std::setprecision(2)
+                << std::setw(10) << before << " ms -> " << std::setw(8)
+                << it->second << " ms " << std::showpos << std::setw(7)
+                << change << std::noshowpos << "%"
+                << (ok ? "" : "  SLOWER") << "\n";
+      passed = passed && ok;
+    }
+  }
+  return passed ? 0 : 1;
+}
@@ -5,8 +5,16 @@
    Copyright © 2016 Dmitri Makarov. All rights reserved.
 */
 
+#include "image.h"
 #include "scene.h"
+#include "trace.h"
 #include "gtest/gtest.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
 
 TEST(RGB8, DefaultConstructor) {
   const RGB8 black;
@@ -53,12 +61,71 @@ TEST(Polygon, GetVertices) {
   EXPECT_EQ(v[2].y, 9);
 }
 
+TEST(Polygon, GetDisplacement) {
+  Frame f;
+  f.vertices.emplace_back(Point{0,0});
+  f.vertices.emplace_back(Point{10,0});
+  f.vertices.emplace_back(Point{0,10});
+  f.number = 1;
+  Polygon p;
+  p.keyframes.emplace_back(f);
+  f.number = 3;
+  p.keyframes.emplace_back(f);
+  f.vertices[1] = Point{10,8};
+  f.number = 5;
+  p.keyframes.emplace_back(f);
+  EXPECT_EQ(0.f, p.getDisplacement(1.0f, 3.0f));
+  EXPECT_EQ(4.f, p.getDisplacement(2.5f, 4.0f));
+  EXPECT_EQ(8.f, p.getDisplacement(1.0f, 9.0f));
+  EXPECT_EQ(0.f, p.getDisplacement(5.0f, 9.0f));
+}
+
 TEST(Scene, RenderToFile) {
   Scene s;
   std::vector<std::string> args{"1", "1", "../examples/sample1.obs", "image"};
   s.renderToFile(args);
 }
 
+TEST(Scene, Generate) {
+  StressSpec spec;
+  spec.polygons = 30;
+  spec.vertices = 7;
+  spec.keyframes = 3;
+  spec.convex = 1.0f;
+  spec.concave = 1.0f;
+  spec.crossing = 1.0f;
+  Scene a;
+  a.generate(spec);
+  Scene b;
+  b.generate(spec);
+  ASSERT_EQ(30u, a.getPolygons().size());
+  auto convex = 0;
+  for (size_t i = 0; i < 30; ++i) {
+    auto& p = *a.getPolygons()[i];
+    auto& q = *b.getPolygons()[i];
+    ASSERT_EQ(3u, p.getNumKeyframes());
+    EXPECT_EQ(7u, p.getNumVertices());
+    EXPECT_EQ(21, p.keyframes[2].number);
+    EXPECT_EQ(p.getColor().pixel, q.getColor().pixel);
+    for (size_t j = 0; j < 7; ++j) {
+      EXPECT_EQ(p.keyframes[1].vertices[j].x, q.keyframes[1].vertices[j].x);
+      EXPECT_EQ(p.keyframes[1].vertices[j].y, q.keyframes[1].vertices[j].y);
+    }
+    convex += isConvex(p.keyframes[0].vertices);
+  }
+  // about a third of the polygons are convex.
+  EXPECT_GT(convex, 3);
+  EXPECT_LT(convex, 20);
+  // the saved scene loads back the same.
+  a.save("generated.obs");
+  Scene c;
+  ASSERT_TRUE(c.load("generated.obs"));
+  ASSERT_EQ(30u, c.getPolygons().size());
+  EXPECT_EQ(a.getPolygons()[29]->keyframes[2].vertices[6].x,
+            c.getPolygons()[29]->keyframes[2].vertices[6].x);
+  std::remove("generated.obs");
+}
+
 TEST(Rasterizer, Rasterize) {
   std::vector<std::shared_ptr<Polygon>> polygons;
   Rasterizer r{500, 500};
@@ -66,6 +133,698 @@ TEST(Rasterizer, Rasterize) {
   (void) r.getPixelsAsRGB();
 }
 
+TEST(Rasterizer, AdaptiveMatchesFull) {
+  Frame f;
+  f.vertices.emplace_back(Point{40.3f, 30.7f});
+  f.vertices.emplace_back(Point{170.2f, 60.1f});
+  f.vertices.emplace_back(Point{150.6f, 180.4f});
+  f.vertices.emplace_back(Point{20.5f, 140.9f});
+  f.number = 1;
+  auto p = std::make_shared<Polygon>();
+  p->keyframes.emplace_back(f);
+  p->setColor(200, 100, 50);
+  std::vector<std::shared_ptr<Polygon>> polygons{p};
+  Rasterizer full{200, 200};
+  full.run(polygons, 1, true, 16, false, 1, "grid");
+  Rasterizer adaptive{200, 200};
+  adaptive.run(polygons, 1, true, 16, false, 1, "grid adaptive");
+  auto* a = full.getPixelsAsRGB();
+  auto* b = adaptive.getPixelsAsRGB();
+  EXPECT_TRUE(std::equal(a, a + 200 * 200 * 3, b));
+  free(a);
+  free(b);
+}
+
+TEST(Rasterizer, CachedLayers) {
+  auto rectangle = [](float x0, float y0, float x1, float y1, int frame) {
+    Frame f;
+    f.vertices.emplace_back(Point{x0, y0});
+    f.vertices.emplace_back(Point{x1, y0});
+    f.vertices.emplace_back(Point{x1, y1});
+    f.vertices.emplace_back(Point{x0, y1});
+    f.number = frame;
+    return f;
+  };
+  auto bottom = std::make_shared<Polygon>();
+  bottom->keyframes.emplace_back(rectangle(10.5f, 10.5f, 90.5f, 90.5f, 1));
+  bottom->setColor(0, 0, 255);
+  auto top = std::make_shared<Polygon>();
+  top->keyframes.emplace_back(rectangle(30.3f, 120.6f, 170.8f, 150.2f, 1));
+  top->setColor(0, 255, 0);
+  // the moving polygon stays apart from the still ones, or its edges cross
+  // the edges of the bottom one, which isn't cached then.
+  auto apart = std::make_shared<Polygon>();
+  apart->keyframes.emplace_back(rectangle(120.2f, 20.7f, 150.4f, 60.1f, 1));
+  apart->keyframes.emplace_back(rectangle(130.2f, 30.7f, 160.4f, 70.1f, 5));
+  apart->setColor(255, 0, 0);
+  auto crossing = std::make_shared<Polygon>();
+  crossing->keyframes.emplace_back(rectangle(60.2f, 40.7f, 100.4f, 80.1f, 1));
+  crossing->keyframes.emplace_back(rectangle(70.2f, 50.7f, 110.4f, 90.1f, 5));
+  crossing->setColor(255, 0, 0);
+  for (auto moving : {apart, crossing}) {
+    std::vector<std::shared_ptr<Polygon>> polygons{bottom, moving, top};
+    for (std::string filter : {"grid", "random", "grid,adaptive"}) {
+      Rasterizer r{200, 200};
+      Layers layers;
+      r.cache(polygons, 1, 5, true, 16, filter, layers);
+      EXPECT_EQ(moving == apart ? 1u : 0u, layers.below);
+      EXPECT_EQ(1u, layers.above);
+      for (int frame = 1; frame <= 5; ++frame) {
+        r.run(polygons, frame, true, 16, true, 4, filter);
+        auto* a = r.getPixelsAsRGB();
+        r.run(polygons, frame, true, 16, true, 4, filter, &layers);
+        auto* b = r.getPixelsAsRGB();
+        EXPECT_TRUE(std::equal(a, a + 200 * 200 * 3, b))
+          << filter << " frame " << frame;
+        free(a);
+        free(b);
+      }
+    }
+  }
+}
+
+TEST(Scene, SerialMatchesSingleFrames) {
+  // a still polygon crossed by a moving one and another one apart from it.
+  {
+    std::ofstream obs("layers.obs");
+    obs << "Number of Objects: 3\n"
+        << "Object Number: 0\nColor: r: 40, g: 80, b: 200\n"
+        << "Number of Vertices: 3\nNumber of Keyframes: 1\n"
+        << "Keyframe for Frame 1\nVertex 0, x: 100.3, y: 50.6\n"
+        << "Vertex 1, x: 400.2, y: 120.1\nVertex 2, x: 180.7, y: 420.4\n"
+        << "Object Number: 1\nColor: r: 230, g: 60, b: 30\n"
+        << "Number of Vertices: 3\nNumber of Keyframes: 2\n"
+        << "Keyframe for Frame 1\nVertex 0, x: 30, y: 200\n"
+        << "Vertex 1, x: 260, y: 160\nVertex 2, x: 150, y: 480\n"
+        << "Keyframe for Frame 6\nVertex 0, x: 230, y: 210\n"
+        << "Vertex 1, x: 470, y: 170\nVertex 2, x: 350, y: 490\n"
+        << "Object Number: 2\nColor: r: 250, g: 250, b: 90\n"
+        << "Number of Vertices: 3\nNumber of Keyframes: 1\n"
+        << "Keyframe for Frame 1\nVertex 0, x: 10.3, y: 10.4\n"
+        << "Vertex 1, x: 90.6, y: 20.2\nVertex 2, x: 40.1, y: 80.9\n";
+  }
+  // the ranges have still polygons cached in layers, still polygons near
+  // moving ones, and frames after the last keyframe that are reused.
+  for (std::string name : {"sample1", "sampleA", "sampleM", "layers"}) {
+    auto file = (name == "layers") ? "layers.obs"
+                                   : "../examples/" + name + ".obs";
+    Scene serial;
+    ASSERT_TRUE(serial.renderToFile({"-a16", "-m4", "1", "14", file,
+                                     "serial"}));
+    for (auto frame : {"3", "8", "12", "14"}) {
+      Scene single;
+      ASSERT_TRUE(single.renderToFile({"-a16", "-m4", frame, frame, file,
+                                       "single"}));
+      Image a, b;
+      ASSERT_TRUE(a.load(std::string("serial.") + frame + ".ppm"));
+      ASSERT_TRUE(b.load(std::string("single.") + frame + ".ppm"));
+      EXPECT_TRUE(a.rgb == b.rgb) << name << " frame " << frame;
+      std::remove((std::string("single.") + frame + ".ppm").c_str());
+    }
+    for (int frame = 1; frame <= 14; ++frame) {
+      std::remove(("serial." + std::to_string(frame) + ".ppm").c_str());
+    }
+  }
+  std::remove("serial.list");
+  std::remove("single.list");
+  std::remove("layers.obs");
+}
+
+TEST(Scene, CropIntoMovingFrames) {
+  // the still crop is the same in both frames, the frames it's put into
+  // aren't.
+  Scene moving;
+  ASSERT_TRUE(moving.renderToFile({"2", "3", "../examples/sampleM.obs",
+                                   "moving"}));
+  Scene still;
+  ASSERT_TRUE(still.renderToFile({"--crop=10,10,40x40", "--into=moving",
+                                  "2", "3", "../examples/sampleA.obs",
+                                  "still"}));
+  for (auto frame : {"2", "3"}) {
+    Image into, crop;
+    ASSERT_TRUE(into.load(std::string("moving.") + frame + ".ppm"));
+    ASSERT_TRUE(crop.load(std::string("still.") + frame + ".ppm"));
+    into.paste(crop.crop(10, 10, 40, 40), 10, 10);
+    EXPECT_EQ(0, into.maxError(crop)) << "frame " << frame;
+    std::remove((std::string("moving.") + frame + ".ppm").c_str());
+    std::remove((std::string("still.") + frame + ".ppm").c_str());
+  }
+  std::remove("moving.list");
+  std::remove("still.list");
+}
+
+TEST(Rasterizer, Signature) {
+  Frame f;
+  f.vertices.emplace_back(Point{10,10});
+  f.vertices.emplace_back(Point{50,10});
+  f.vertices.emplace_back(Point{30,40});
+  f.number = 1;
+  auto p = std::make_shared<Polygon>();
+  p->keyframes.emplace_back(f);
+  f.vertices[2] = Point{30,60};
+  f.number = 4;
+  p->keyframes.emplace_back(f);
+  std::vector<std::shared_ptr<Polygon>> polygons{p};
+  Rasterizer r{100, 100};
+  auto signature = [&r, &polygons](int frame, int mb) {
+    return r.signature(polygons, frame, true, 4, true, mb, "");
+  };
+  EXPECT_NE(signature(2, 4), signature(3, 4));
+  EXPECT_NE(signature(4, 4), signature(5, 4));
+  EXPECT_EQ(signature(5, 4), signature(6, 4));
+  EXPECT_EQ(signature(4, 1), signature(7, 1));
+  EXPECT_NE(signature(6, 1), signature(6, 4));
+}
+
+TEST(Rasterizer, SingleSample) {
+  Frame f;
+  f.vertices.emplace_back(Point{10.5f, 10});
+  f.vertices.emplace_back(Point{70, 22.25f});
+  f.vertices.emplace_back(Point{30, 64});
+  f.number = 1;
+  auto p = std::make_shared<Polygon>();
+  p->keyframes.emplace_back(f);
+  p->setColor(40, 80, 120);
+  std::vector<std::shared_ptr<Polygon>> polygons{p};
+  Rasterizer rendered{90, 70};
+  rendered.run(polygons, 1, false, 16, false, 8, "");
+  Rasterizer converted{90, 70};
+  std::vector<Point> vertices;
+  auto color = p->getVertices(1, vertices);
+  converted.scanConvert(vertices, color);
+  auto* a = rendered.getPixelsAsRGB();
+  auto* b = converted.getPixelsAsRGB();
+  EXPECT_TRUE(std::equal(a, a + 90 * 70 * 3, b));
+  free(a);
+  free(b);
+}
+
+TEST(Rasterizer, ConcurrentSettings) {
+  Frame f;
+  f.vertices.emplace_back(Point{12.3f, 8.7f});
+  f.vertices.emplace_back(Point{90.2f, 30.1f});
+  f.vertices.emplace_back(Point{40.6f, 95.4f});
+  f.number = 1;
+  auto p = std::make_shared<Polygon>();
+  p->keyframes.emplace_back(f);
+  f.vertices[1] = Point{70.2f, 60.1f};
+  f.number = 5;
+  p->keyframes.emplace_back(f);
+  p->setColor(90, 180, 30);
+  std::vector<std::shared_ptr<Polygon>> polygons{p};
+  // the frames rendered one after another, in reverse, and at the same time.
+  RenderSettings settings(true, 9, true, 4, "rand bart");
+  settings.seed = 7;
+  Rasterizer sequential[2];
+  Rasterizer concurrent[2];
+  for (int i = 1; i >= 0; --i) {
+    sequential[i].resize(100, 100);
+    concurrent[i].resize(100, 100);
+    sequential[i].run(polygons, 2 + i, settings);
+  }
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; ++i) {
+    threads.emplace_back([&concurrent, &polygons, &settings, i]() {
+        concurrent[i].run(polygons, 2 + i, settings);
+      });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  for (int i = 0; i < 2; ++i) {
+    auto* a = sequential[i].getPixelsAsRGB();
+    auto* b = concurrent[i].getPixelsAsRGB();
+    EXPECT_TRUE(std::equal(a, a + 100 * 100 * 3, b)) << "frame " << 2 + i;
+    free(a);
+    free(b);
+  }
+}
+
+TEST(Rasterizer, Stats) {
+  Frame f;
+  f.vertices.emplace_back(Point{0, 0});
+  f.vertices.emplace_back(Point{10, 0});
+  f.vertices.emplace_back(Point{10, 10});
+  f.vertices.emplace_back(Point{0, 10});
+  f.number = 1;
+  auto p = std::make_shared<Polygon>();
+  p->keyframes.emplace_back(f);
+  std::vector<std::shared_ptr<Polygon>> polygons{p, p};
+  Rasterizer r{50, 50};
+  auto single = r.run(polygons, 1, false, 1, false, 1, "grid");
+  EXPECT_EQ(1, single.frame);
+  EXPECT_EQ(1u, single.passes);
+  EXPECT_EQ(2u, single.polygons);
+  EXPECT_EQ(20u, single.spans);
+  EXPECT_EQ(2u * 10u * 11u, single.pixels);
+  EXPECT_EQ(0u, single.memory);
+  auto stats = r.run(polygons, 1, true, 4, false, 1, "grid");
+  EXPECT_EQ(4u, stats.passes);
+  EXPECT_EQ(8u, stats.polygons);
+  EXPECT_GT(stats.memory, 50u * 50u * sizeof(RGB32));
+  EXPECT_GE(stats.scan, 0.0);
+  std::ostringstream os;
+  os << stats;
+  EXPECT_EQ(0u, os.str().find("{\"frame\": 1, "));
+  // the polygons beside the canvas aren't scanned.
+  f.vertices = {Point{60, 0}, Point{70, 0}, Point{70, 10}};
+  auto beside = std::make_shared<Polygon>();
+  beside->keyframes.emplace_back(f);
+  polygons.push_back(beside);
+  EXPECT_EQ(2u, r.run(polygons, 1, false, 1, false, 1, "grid").polygons);
+}
+
+TEST(Rasterizer, Profile) {
+  auto square = [](float x0, float x1) {
+    auto p = std::make_shared<Polygon>();
+    Frame f;
+    f.vertices = {Point{x0, x0}, Point{x1, x0}, Point{x1, x1}, Point{x0, x1}};
+    f.number = 1;
+    p->keyframes.emplace_back(f);
+    return p;
+  };
+  std::vector<std::shared_ptr<Polygon>> polygons{square(0, 40),
+                                                 square(10, 15)};
+  Rasterizer r{50, 50};
+  Profile profile(true);
+  RenderSettings settings(true, 4, false, 1, "grid");
+  auto stats = r.run(polygons, 1, settings, nullptr, &profile);
+  ASSERT_EQ(2u, profile.costs.size());
+  EXPECT_EQ(4u, profile.costs[0].samples);
+  EXPECT_EQ(4u * 2u, profile.costs[0].edges);
+  EXPECT_EQ(2u, profile.costs[0].active);
+  // the grid shifts move the squares off the pixel centers.
+  EXPECT_EQ(4u * 40u * 40u, profile.costs[0].pixels);
+  EXPECT_EQ(4u * 5u * 5u, profile.costs[1].pixels);
+  EXPECT_EQ(stats.edges, profile.costs[0].edges + profile.costs[1].edges);
+  EXPECT_EQ(2u, stats.active);
+  size_t writes = 0;
+  for (auto w : profile.writes) {
+    writes += w;
+  }
+  EXPECT_EQ(stats.pixels, writes);
+  std::ostringstream os;
+  profile.report(os, 1);
+  EXPECT_NE(std::string::npos, os.str().find("\n   1       0 "));
+  EXPECT_EQ(std::string::npos, os.str().find("\n   2 "));
+}
+
+/**
+   \brief GeneratedScene is a fixture of the tests on a generated scene,
+          rendered with 4 AA and 4 MB samples unless a test changes it.
+*/
+class GeneratedScene : public ::testing::Test {
+protected:
+  Scene scene;
+  RenderSettings settings;
+
+  GeneratedScene() : settings(true, 4, true, 4) {}
+
+  // generate <polygons> polygons on a canvas of <w> x <h>, the convex ones
+  // mixed with the shares of <concave> and <crossing> ones.
+  void generate(int w, int h, int polygons, float concave = 0.0f,
+                float crossing = 0.0f) {
+    scene.resize(w, h);
+    StressSpec spec;
+    spec.polygons = polygons;
+    spec.concave = concave;
+    spec.crossing = crossing;
+    scene.generate(spec);
+  }
+};
+
+TEST_F(GeneratedScene, Allocations) {
+  ASSERT_TRUE(Allocations::counted);
+  generate(500, 500, 20);
+  auto& r = scene.getRasterizer();
+  auto first = r.run(scene.getPolygons(), 5, settings);
+  auto second = r.run(scene.getPolygons(), 5, settings);
+  EXPECT_GT(first.allocations, 0u);
+  EXPECT_EQ(first.allocations, second.allocations);
+  EXPECT_EQ(first.allocated, second.allocated);
+  // the accumulation buffer and the scratch canvases are live at once.
+  EXPECT_GE(first.peak, first.memory);
+  EXPECT_GT(first.scratch, 0u);
+  auto single = r.run(scene.getPolygons(), 5, RenderSettings());
+  EXPECT_LT(single.peak, first.peak);
+}
+
+TEST(Scene, Tune) {
+  {
+    std::ofstream obs("tune.obs");
+    obs << "Number of Objects: 1\nObject Number: 0\n"
+        << "Color: r: 214, g: 235, b: 255\nNumber of Vertices: 3\n"
+        << "Number of Keyframes: 1\nKeyframe for Frame 1\n"
+        << "Vertex 0, x: 3, y: 5\nVertex 1, x: 30, y: 8\n"
+        << "Vertex 2, x: 20, y: 33\n";
+  }
+  Scene scene(40, 40);
+  ASSERT_TRUE(scene.load("tune.obs"));
+  std::remove("tune.obs");
+  auto rough = scene.tune(1, 1, 20.0, 0.0);
+  EXPECT_TRUE(rough.found);
+  EXPECT_GE(rough.psnr, 20.0);
+  auto fine = scene.tune(1, 1, 35.0, 0.99);
+  EXPECT_TRUE(fine.found);
+  EXPECT_GE(fine.ssim, 0.99);
+  EXPECT_GE(fine.num_aa_samples * fine.num_mb_samples,
+            rough.num_aa_samples * rough.num_mb_samples);
+  // a still scene needs no MB samples.
+  EXPECT_EQ(1, fine.num_mb_samples);
+  EXPECT_EQ(0u, fine.options().find("-a"));
+  // 64 AA samples render a still scene the same as the reference does.
+  auto exact = scene.tune(1, 1, 200.0, 0.0);
+  EXPECT_TRUE(exact.found);
+  EXPECT_EQ(64, exact.num_aa_samples);
+}
+
+TEST(Image, Compare) {
+  Image a(16, 16);
+  auto b = a;
+  EXPECT_TRUE(std::isinf(a.psnr(b)));
+  EXPECT_DOUBLE_EQ(1.0, a.ssim(b));
+  b.rgb[0] = 255;
+  EXPECT_EQ(255, a.maxError(b));
+  EXPECT_NEAR(10 * std::log10(3.0 * 256), a.psnr(b), 1e-9);
+  EXPECT_LT(a.ssim(b), 1.0);
+}
+
+TEST(Trace, ChromeEvents) {
+  auto p = std::make_shared<Polygon>();
+  Frame f;
+  f.vertices = {Point{0, 0}, Point{10, 0}, Point{5, 10}};
+  f.number = 1;
+  p->keyframes.emplace_back(f);
+  Rasterizer r{20, 20};
+  Trace::start(Trace::DETAIL);
+  r.run({p}, 1, true, 4, false, 1, "grid");
+  std::string filename{"rasterizer_unittest.json"};
+  ASSERT_TRUE(Trace::stop(filename));
+  std::ifstream ifs(filename);
+  std::stringstream json;
+  json << ifs.rdbuf();
+  std::remove(filename.c_str());
+  EXPECT_EQ(0u, json.str().find("{\"traceEvents\": ["));
+  auto count = [&](const std::string& name) {
+    auto n = 0;
+    for (auto i = json.str().find(name); i != std::string::npos;
+         i = json.str().find(name, i + 1)) {
+      ++n;
+    }
+    return n;
+  };
+  EXPECT_EQ(Trace::compiled() ? 1 : 0, count("\"Rasterizer::run\""));
+  EXPECT_EQ(Trace::compiled() ? 4 : 0, count("\"sample\""));
+  EXPECT_EQ(Trace::compiled() ? 4 : 0, count("\"Polygon::getVertices\""));
+  EXPECT_FALSE(Trace::on(Trace::COARSE));
+}
+
+TEST_F(GeneratedScene, TimeBudget) {
+  generate(500, 500, 50);
+  auto& r = scene.getRasterizer();
+  settings = RenderSettings(true, 16, true, 4, "grid");
+  auto all = r.run(scene.getPolygons(), 5, settings);
+  Image full(r);
+  // all samples are taken in time, in another order.
+  settings.budget = 1e6;
+  auto stats = r.run(scene.getPolygons(), 5, settings);
+  EXPECT_EQ(all.passes, stats.passes);
+  EXPECT_EQ(all.planned, stats.planned);
+  EXPECT_EQ(0, Image(r).maxError(full));
+  // one pass is taken even if there's no time, and the image is normalized.
+  settings.budget = 1e-9;
+  stats = r.run(scene.getPolygons(), 5, settings);
+  EXPECT_EQ(all.planned, stats.planned);
+  EXPECT_EQ(1u, stats.passes);
+  EXPECT_GT(Image(r).psnr(full), 20.0);
+}
+
+TEST_F(GeneratedScene, RenderBands) {
+  generate(300, 200, 40, 1.0f);
+  Profile whole(true);
+  scene.getRasterizer().run(scene.getPolygons(), 5, settings, nullptr, &whole);
+  Image full(scene.getRasterizer());
+  // the last band is shorter than the others, the others are rendered with
+  // a line above and below in 3 rows of tiles.
+  Profile profile(true);
+  auto stats = scene.renderBands(5, settings, 300, 200, 46, "bands.ppm",
+                                 &profile);
+  Image bands;
+  ASSERT_TRUE(bands.load("bands.ppm"));
+  std::remove("bands.ppm");
+  ASSERT_EQ(200, bands.height);
+  EXPECT_EQ(0, bands.maxError(full));
+  EXPECT_LT(stats.memory, 300u * 100u * sizeof(RGB32));
+  // the heatmap of the bands is the one of the whole canvas, but for the
+  // lines next to the edges of the bands that are drawn twice.
+  ASSERT_EQ(whole.writes.size(), profile.writes.size());
+  EXPECT_EQ(whole.costs.size(), profile.costs.size());
+  for (int y = 0; y < 200; ++y) {
+    for (int x = 0; x < 300; ++x) {
+      auto i = y * 300 + x;
+      if (y % 46 == 0 || y % 46 == 45) {
+        EXPECT_LE(whole.writes[i], profile.writes[i]);
+      } else {
+        EXPECT_EQ(whole.writes[i], profile.writes[i]);
+      }
+    }
+  }
+  // a time budget is for the whole frame, not for every band.
+  settings = RenderSettings(true, 64, true, 16);
+  settings.budget = 0.02;
+  auto started = std::chrono::steady_clock::now();
+  stats = scene.renderBands(5, settings, 300, 200, 4, "bands.ppm");
+  std::chrono::duration<double> took =
+    std::chrono::steady_clock::now() - started;
+  std::remove("bands.ppm");
+  EXPECT_LT(took.count(), 0.2);
+  EXPECT_LE(stats.passes, stats.planned);
+}
+
+TEST_F(GeneratedScene, Crop) {
+  generate(300, 200, 40, 0.0f, 1.0f);
+  auto whole = scene.getRasterizer().run(scene.getPolygons(), 5, settings);
+  Image full(scene.getRasterizer());
+  Rasterizer crop(70, 50);
+  crop.setOrigin(205, 133);
+  auto stats = crop.run(scene.getPolygons(), 5, settings);
+  EXPECT_EQ(0, Image(crop).maxError(full.crop(205, 133, 70, 50)));
+  EXPECT_LT(stats.pixels * 10, whole.pixels);
+  // the crop put back into the whole canvas changes nothing.
+  auto copy = full;
+  copy.paste(Image(crop), 205, 133);
+  EXPECT_EQ(0, copy.maxError(full));
+}
+
+TEST_F(GeneratedScene, PackedRGB) {
+  generate(150, 100, 20);
+  auto& r = scene.getRasterizer();
+  r.run(scene.getPolygons(), 1, settings);
+  auto* rgb = r.getRGB();
+  // the next frames are packed with the resolve.
+  r.run(scene.getPolygons(), 3, settings);
+  EXPECT_EQ(rgb, r.getRGB());
+  Rasterizer fresh(150, 100);
+  fresh.run(scene.getPolygons(), 3, settings);
+  EXPECT_TRUE(std::equal(rgb, rgb + 150 * 100 * 3, fresh.getRGB()));
+  // and pixels filled later are packed again.
+  std::vector<Point> square{Point{10, 10}, Point{30, 10}, Point{30, 30},
+                            Point{10, 30}};
+  r.scanConvert(square, RGB8{0x030201});
+  auto* p = r.getRGB() + 3 * (20 * 150 + 20);
+  EXPECT_EQ(1, p[0]);
+  EXPECT_EQ(2, p[1]);
+  EXPECT_EQ(3, p[2]);
+}
+
+TEST(Rasterizer, FixedPointScanConvert) {
+  // the edge crosses the line 268 exactly at the pixel 157.
+  std::vector<Point> triangle{Point{73, 84}, Point{178, 314}, Point{242, 315}};
+  Rasterizer exact{500, 500};
+  exact.scanConvert(triangle, RGB8{0xffffff});
+  auto* pixels = exact.getPixelsAsRGB();
+  EXPECT_EQ(0xff, pixels[(157 + 268 * 500) * 3]);
+  EXPECT_EQ(0x00, pixels[(156 + 268 * 500) * 3]);
+  free(pixels);
+
+  // random polygons, some of them concave or self-intersecting.
+  std::mt19937 engine(17);
+  std::uniform_real_distribution<float> coordinate(-50.0f, 350.0f);
+  Rasterizer fixed{300, 300};
+  Rasterizer reference{300, 300};
+  for (int i = 0; i < 20; ++i) {
+    std::vector<Point> vertices;
+    for (int j = 0; j < 3 + i % 5; ++j) {
+      vertices.emplace_back(Point{coordinate(engine), coordinate(engine)});
+    }
+    RGB8 color{static_cast<unsigned int>(0x10101 * (i + 1))};
+    fixed.scanConvert(vertices, color);
+    reference.scanConvertFloat(vertices, color);
+  }
+  auto* a = fixed.getPixelsAsRGB();
+  auto* b = reference.getPixelsAsRGB();
+  auto differ = 0;
+  for (int i = 0; i < 300 * 300 * 3; i += 3) {
+    differ += (a[i] != b[i]);
+  }
+  EXPECT_LT(differ, 300 * 300 / 1000);
+  free(a);
+  free(b);
+}
+
+TEST(Rasterizer, FarVertices) {
+  // the long edge goes on with the slope 1/2 far beyond the fixed point
+  // range, it leaves the canvas at the pixel (499, 255).
+  std::vector<Point> triangle{Point{10, 10}, Point{3e6f, 1.5e6f},
+                              Point{10, 400}};
+  Rasterizer fixed{500, 500};
+  Rasterizer convex{500, 500};
+  Rasterizer reference{500, 500};
+  fixed.scanConvert(triangle, RGB8{0xffffff});
+  convex.scanConvertConvex(triangle, RGB8{0xffffff});
+  reference.scanConvertFloat(triangle, RGB8{0xffffff});
+  auto* a = fixed.getRGB();
+  EXPECT_EQ(0x00, a[(499 + 254 * 500) * 3]);
+  EXPECT_EQ(0xff, a[(499 + 255 * 500) * 3]);
+  EXPECT_TRUE(std::equal(a, a + 500 * 500 * 3, convex.getRGB()));
+  auto* b = reference.getRGB();
+  auto differ = 0;
+  for (int i = 0; i < 500 * 500 * 3; i += 3) {
+    differ += (a[i] != b[i]);
+  }
+  EXPECT_LT(differ, 500);
+}
+
+TEST(Polygon, IsConvex) {
+  std::vector<Point> square{Point{0, 0}, Point{4, 0}, Point{4, 4}, Point{0, 4}};
+  EXPECT_TRUE(isConvex(square));
+  std::vector<Point> arrow{Point{0, 0}, Point{4, 2}, Point{0, 4}, Point{1, 2}};
+  EXPECT_FALSE(isConvex(arrow));
+  std::vector<Point> star;
+  for (int i = 0; i < 5; ++i) {
+    auto angle = i * 4 * M_PI / 5;
+    star.emplace_back(Point{static_cast<float>(10 * cos(angle)),
+                            static_cast<float>(10 * sin(angle))});
+  }
+  EXPECT_FALSE(isConvex(star));
+}
+
+TEST(Rasterizer, ConvexScanConvert) {
+  std::mt19937 engine(5);
+  std::uniform_real_distribution<float> center(-20.0f, 220.0f);
+  std::uniform_real_distribution<float> radius(0.5f, 120.0f);
+  std::uniform_real_distribution<float> angle(0.0f, 2 * M_PI);
+  Rasterizer convex{200, 200};
+  Rasterizer general{200, 200};
+  for (int i = 0; i < 50; ++i) {
+    // a random convex polygon or a star that is not convex
+    std::vector<Point> vertices;
+    auto x = center(engine);
+    auto y = center(engine);
+    auto r = radius(engine);
+    auto a = angle(engine);
+    auto n = 3 + i % 6;
+    auto step = (i % 10 == 9) ? 4 * M_PI / 5 : 2 * M_PI / n;
+    for (int j = 0; j < n; ++j) {
+      auto phi = a + j * step;
+      vertices.emplace_back(Point{static_cast<float>(x + r * cos(phi)),
+                                  static_cast<float>(y + r * sin(phi))});
+    }
+    RGB8 color{static_cast<unsigned int>(0x30507 * (i + 1))};
+    convex.scanConvertConvex(vertices, color);
+    general.scanConvert(vertices, color);
+    auto* p = convex.getPixelsAsRGB();
+    auto* q = general.getPixelsAsRGB();
+    EXPECT_TRUE(std::equal(p, p + 200 * 200 * 3, q)) << "polygon " << i;
+    free(p);
+    free(q);
+  }
+}
+
+TEST(Abuffer, UniformTiles) {
+  // a canvas with partial tiles on the right and at the bottom.
+  const int w = TILE_SIZE * 2 + 5;
+  const int h = TILE_SIZE + 3;
+  Abuffer tiled(w, h);
+  Abuffer plain(w, h);
+  auto& layout = tiled.layout;
+  std::vector<RGB8> colors(tiled.size, RGB8{0x102030});
+  std::vector<RGB8> tags(3 * 2, RGB8{0x102030});
+  // the second tile is mixed, the last one is black.
+  tags[1] = MIXED_TILE;
+  colors[layout.index(TILE_SIZE + 1, 0)] = 0x0000ff;
+  tags[5] = 0;
+  for (int y = TILE_SIZE; y < h; ++y) {
+    for (int x = 2 * TILE_SIZE; x < w; ++x) {
+      colors[layout.index(x, y)] = RGB8{};
+    }
+  }
+  for (unsigned int weight = 1; weight < 4; ++weight) {
+    tiled.add(colors.data(), tags.data(), weight);
+    plain.add(colors.data(), colors.size(), weight);
+  }
+  std::vector<RGB8> a(tiled.size);
+  std::vector<RGB8> b(tiled.size);
+  tiled.get(a.data(), a.size(), 6);
+  plain.get(b.data(), b.size(), 6);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      auto i = layout.index(x, y);
+      EXPECT_EQ(b[i].pixel, a[i].pixel) << "pixel " << x << ", " << y;
+    }
+  }
+  tiled.flatten();
+  tiled.get(a.data(), a.size(), 6);
+  EXPECT_EQ(b[0].pixel, a[0].pixel);
+}
+
+TEST(Kernels, SameOnAllLevels) {
+  std::mt19937 engine(5);
+  const size_t n = 1000 + 13;
+  std::vector<RGB8> colors(n);
+  for (auto& c : colors) {
+    c = engine() & 0xffffff;
+  }
+  std::vector<RGB32> sums(n);
+  RGB32 tile(RGB8{0x030201});
+  auto run = [&](const Kernels& k, std::vector<RGB8>& resolved,
+                 std::vector<unsigned char>& rgb) {
+    std::fill(sums.begin(), sums.end(), RGB32());
+    k.accumulate(sums.data(), colors.data(), n, 1);
+    k.accumulate(sums.data() + 1, colors.data() + 1, n - 3, 7);
+    resolved.assign(n, RGB8{});
+    k.resolve(resolved.data(), sums.data(), n, tile, 8);
+    k.fill(resolved.data() + 5, n - 11, RGB8{0x405060});
+    rgb.assign(3 * n, 0);
+    k.pack(resolved.data(), n - 1, rgb.data());
+  };
+  auto detected = Kernels::detect();
+  ASSERT_TRUE(Kernels::select(Kernels::GENERIC));
+  std::vector<RGB8> expected;
+  std::vector<unsigned char> expected_rgb;
+  run(Kernels::get(), expected, expected_rgb);
+  EXPECT_EQ(0x405060u, expected[5].pixel);
+  RGB32 first(colors[0]);
+  first += tile;
+  EXPECT_EQ(first.get(8).pixel, expected[0].pixel);
+  for (int isa = Kernels::SSE42; isa < Kernels::ISA_COUNT; ++isa) {
+    if (!Kernels::select(static_cast<Kernels::ISA>(isa))) {
+      continue;
+    }
+    std::vector<RGB8> resolved;
+    std::vector<unsigned char> rgb;
+    run(Kernels::get(), resolved, rgb);
+    for (size_t i = 0; i < n; ++i) {
+      EXPECT_EQ(expected[i].pixel, resolved[i].pixel)
+        << Kernels::name(Kernels::get().isa) << " pixel " << i;
+    }
+    EXPECT_EQ(expected_rgb, rgb) << Kernels::name(Kernels::get().isa);
+  }
+  Kernels::select(detected);
+  EXPECT_EQ(Kernels::AVX2, Kernels::parse("avx2"));
+  EXPECT_EQ(Kernels::ISA_COUNT, Kernels::parse("neon"));
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);